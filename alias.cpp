@@ -0,0 +1,93 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <vector>
+
+#include "alias.h"
+
+/*
+ * Build t from weight, which is used up. Fails, leaving t empty, when the
+ * weights sum to zero or, scaled by their number, overflow.
+ */
+bool
+alias_build(alias_table &t, std::vector<uint64_t> &weight)
+{
+	std::size_t const m = weight.size();
+	std::vector<std::size_t> small;
+	std::vector<std::size_t> large;
+
+	t.prob.clear();
+	t.alias.clear();
+	t.total = 0;
+
+	if (m == 0 || m > UINT32_MAX) {
+		return false;
+	}
+
+	for (auto const w : weight) {
+		if (w > UINT64_MAX / m || t.total > UINT64_MAX / m - w) {
+			return false;
+		}
+
+		t.total += w;
+	}
+
+	if (t.total == 0 || t.total > UINT64_MAX / m) {
+		return false;
+	}
+
+	t.prob.resize(m);
+	t.alias.resize(m);
+
+	/* scaled by m, a column holds total */
+	for (std::size_t i = 0; i < m; ++i) {
+		weight[i] *= m;
+		(weight[i] < t.total ? small : large).push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		std::size_t const l = small.back();
+		std::size_t const g = large.back();
+
+		small.pop_back();
+		large.pop_back();
+
+		t.prob[l] = weight[l];
+		t.alias[l] = (uint32_t)g;
+
+		weight[g] -= t.total - weight[l];
+		(weight[g] < t.total ? small : large).push_back(g);
+	}
+
+	/* what is left fills its column exactly */
+	for (auto const *const rest : { &small, &large }) {
+		for (auto const i : *rest) {
+			t.prob[i] = t.total;
+			t.alias[i] = (uint32_t)i;
+		}
+	}
+
+	return true;
+}
+
+std::size_t
+alias_draw(alias_table const &t, ranged_random &r)
+{
+	std::size_t const i = r.rrand<std::size_t>(0, t.prob.size() - 1);
+
+	return r.rrand<uint64_t>(0, t.total - 1) < t.prob[i] ? i : t.alias[i];
+}
@@ -0,0 +1,41 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "rand.h"
+
+/*
+ * Draws from a fixed discrete distribution in two draws whatever its size
+ * (Walker's alias method, built as by Vose). Weights are integers and the
+ * table is exact in them.
+ */
+struct alias_table {
+	/* column i keeps i if a draw below total falls under prob[i] */
+	std::vector<uint64_t>	prob;
+	std::vector<uint32_t>	alias;
+	uint64_t		total;
+};
+
+bool		alias_build(alias_table &, std::vector<uint64_t> &);
+std::size_t	alias_draw(alias_table const &, ranged_random &);
+
+#endif /* ALIAS_H */
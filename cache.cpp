@@ -0,0 +1,639 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "gen.h"
+#include "pack.h"
+
+/*
+ * Floors the PC has left, keyed by depth. Each is kept encoded: glyphs and
+ * visited bits run-length coded, hardness only where there is rock, and
+ * the surviving NPCs and objects as description index and state. Distance
+ * maps are not kept, they are rebuilt lazily once the floor is back.
+ *
+ * Encoded floors stay in memory up to the budget. Past it, the floors left
+ * longest ago are spilled to files under ~/.opal until they are taken. A
+ * spill is unlinked as soon as it is created and read back through its
+ * descriptor, so no exit, however abrupt, leaves it behind.
+ */
+struct cache_entry {
+	std::vector<uint8_t>		data;
+	std::size_t			size;
+	std::list<int64_t>::iterator	lru;
+	int				fd;
+	bool				spilled;
+};
+
+static void	insert(int64_t const, std::vector<uint8_t> &&);
+
+static void	encode_stairs(std::vector<uint8_t> &,
+	std::vector<stair> const &);
+static void	decode_stairs(std::vector<uint8_t> const &, std::size_t &,
+	std::vector<stair> &);
+
+static uint8_t	tile_code(grid &, int const, int const);
+static void	tile_decode(grid &, int const, int const, uint8_t const);
+
+static void		evict();
+static std::string	spill_path(int64_t const);
+static void		spill(int64_t const, cache_entry &);
+static void		unspill(cache_entry &);
+static void		spill_read(cache_entry const &,
+	std::vector<uint8_t> &);
+
+/* tile glyphs by code, with the visited bit above them */
+static chtype constexpr GLYPHS[] = { ROCK, ROOM, CORRIDOR, STAIR_UP, STAIR_DN };
+static std::size_t constexpr GLYPHS_L = sizeof(GLYPHS) / sizeof(GLYPHS[0]);
+static uint8_t constexpr VISITED = 1 << 3;
+
+static std::unordered_map<int64_t, cache_entry> entries;
+
+/* floors held in memory, most recently left first */
+static std::list<int64_t> lru;
+
+static std::size_t budget;
+static std::size_t resident;
+
+static uint64_t spills;
+static uint64_t takes;
+static uint64_t take_ns;
+static uint64_t take_max_ns;
+
+/* budget in bytes of encoded floors kept in memory */
+void
+cache_init(std::size_t const bytes)
+{
+	budget = bytes;
+}
+
+void
+cache_stop()
+{
+	for (auto const &e : entries) {
+		if (e.second.spilled && close(e.second.fd) == -1) {
+			warn("cache close");
+		}
+	}
+
+	entries.clear();
+	lru.clear();
+	resident = 0;
+}
+
+bool
+cache_has(int64_t const depth)
+{
+	return entries.count(depth) != 0;
+}
+
+/* encode a floor the PC has left, freeing its NPCs and objects */
+void
+cache_put(int64_t const depth, level &l)
+{
+	if (cache_has(depth)) {
+		errx(1, "floor %" PRId64 " cached twice", depth);
+	}
+
+	std::vector<uint8_t> data;
+
+	floor_encode(l, data, false);
+	insert(depth, std::move(data));
+
+	for (auto &n : l.npcs) {
+		delete n;
+	}
+
+	for (auto &o : l.objs) {
+		delete o;
+	}
+
+	l.npcs.clear();
+	l.objs.clear();
+}
+
+/* decode a cached floor into l, dropping it from the cache */
+bool
+cache_take(int64_t const depth, level &l)
+{
+	auto const start = std::chrono::steady_clock::now();
+	auto const it = entries.find(depth);
+
+	if (it == entries.end()) {
+		return false;
+	}
+
+	cache_entry &e = it->second;
+
+	if (e.spilled) {
+		unspill(e);
+	} else {
+		lru.erase(e.lru);
+		resident -= e.size;
+	}
+
+	std::size_t pos = 0;
+
+	floor_decode(e.data, pos, l);
+
+	if (pos != e.data.size()) {
+		errx(1, "floor cache entry has trailing data");
+	}
+
+	entries.erase(it);
+
+	uint64_t const ns = (uint64_t)std::chrono::duration_cast<
+		std::chrono::nanoseconds>(std::chrono::steady_clock::now()
+		- start).count();
+
+	takes++;
+	take_ns += ns;
+	take_max_ns = std::max(take_max_ns, ns);
+
+	return true;
+}
+
+/*
+ * Append every cached floor to buf. A spilled one is left for the store to
+ * read, through a duplicate of its descriptor, spliced in where it goes.
+ */
+void
+cache_save(std::vector<uint8_t> &buf, std::vector<store_splice> &spilled)
+{
+	pack_put<uint32_t>(buf, (uint32_t)entries.size());
+
+	/* spilled first, then least recently left, as insert() expects */
+	for (auto const &e : entries) {
+		int fd;
+
+		if (!e.second.spilled) {
+			continue;
+		}
+
+		if ((fd = dup(e.second.fd)) == -1) {
+			err(1, "cache dup");
+		}
+
+		pack_put<int64_t>(buf, e.first);
+		pack_put<uint64_t>(buf, e.second.size);
+		spilled.push_back({ buf.size(), fd, e.second.size });
+	}
+
+	for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+		cache_entry const &e = entries.at(*it);
+
+		pack_put<int64_t>(buf, *it);
+		pack_put<uint64_t>(buf, e.size);
+		buf.insert(buf.end(), e.data.begin(), e.data.end());
+	}
+}
+
+/* the cache must be empty, as at startup */
+void
+cache_load(std::vector<uint8_t> const &buf, std::size_t &pos)
+{
+	uint32_t count = pack_get<uint32_t>(buf, pos);
+
+	for (; count > 0; --count) {
+		int64_t const depth = pack_get<int64_t>(buf, pos);
+		uint64_t const size = pack_get<uint64_t>(buf, pos);
+
+		if (buf.size() - pos < size || cache_has(depth)) {
+			errx(1, "floor cache snapshot invalid");
+		}
+
+		insert(depth, std::vector<uint8_t>(buf.begin()
+			+ (std::ptrdiff_t)pos, buf.begin()
+			+ (std::ptrdiff_t)(pos + size)));
+		pos += size;
+	}
+}
+
+void
+cache_stats(FILE *const f)
+{
+	(void)fprintf(f, "floor cache: %zu floors, %zu bytes resident, "
+		"%" PRIu64 " spills\n", entries.size(), resident, spills);
+	(void)fprintf(f, "cache_take: %" PRIu64 " floors, mean %" PRIu64
+		" us, max %" PRIu64 " us\n", takes,
+		takes == 0 ? 0 : take_ns / takes / 1000, take_max_ns / 1000);
+}
+
+/*
+ * Append the encoding of l to buf. An exact encoding also keeps the dead
+ * and the turn of every NPC, for snapshots of the floor in play.
+ */
+void
+floor_encode(level &l, std::vector<uint8_t> &buf, bool const exact)
+{
+	grid &g = l.tiles;
+	uint8_t code = 0;
+	uint8_t run = 0;
+
+	pack_put<uint8_t>(buf, exact);
+	pack_put<uint16_t>(buf, (uint16_t)g.width);
+	pack_put<uint16_t>(buf, (uint16_t)g.height);
+	pack_put<uint16_t>(buf, l.x);
+	pack_put<uint16_t>(buf, l.y);
+
+	pack_put<uint32_t>(buf, (uint32_t)l.rooms.size());
+
+	for (auto const &r : l.rooms) {
+		pack_put<uint16_t>(buf, r.x);
+		pack_put<uint16_t>(buf, r.y);
+		pack_put<uint16_t>(buf, r.size_x);
+		pack_put<uint16_t>(buf, r.size_y);
+	}
+
+	encode_stairs(buf, l.stairs_up);
+	encode_stairs(buf, l.stairs_dn);
+
+	/* glyphs and visited bits, as (code, length) runs */
+	for (int i = 1; i < g.height - 1; ++i) {
+		for (int j = 1; j < g.width - 1; ++j) {
+			uint8_t const c = tile_code(g, i, j);
+
+			if (run != 0 && (c != code || run == UINT8_MAX)) {
+				pack_put<uint8_t>(buf, code);
+				pack_put<uint8_t>(buf, run);
+				run = 0;
+			}
+
+			code = c;
+			run++;
+		}
+	}
+
+	pack_put<uint8_t>(buf, code);
+	pack_put<uint8_t>(buf, run);
+
+	/* anything but rock is open */
+	for (int i = 1; i < g.height - 1; ++i) {
+		for (int j = 1; j < g.width - 1; ++j) {
+			if (g.c(i, j) == ROCK) {
+				pack_put<uint8_t>(buf, g.h(i, j));
+			}
+		}
+	}
+
+	/* otherwise the dead are left behind */
+	uint32_t count = 0;
+	std::size_t const npc_count = buf.size();
+	pack_put<uint32_t>(buf, 0);
+
+	for (auto const n : l.npcs) {
+		if (!exact && (n->dead || n->hp == 0)) {
+			continue;
+		}
+
+		pack_put<uint32_t>(buf, (uint32_t)proto_index(*n));
+		pack_put<uint16_t>(buf, n->x);
+		pack_put<uint16_t>(buf, n->y);
+		pack_put<uint64_t>(buf, n->hp);
+		pack_put<uint64_t>(buf, n->p_count);
+
+		if (exact) {
+			pack_put<uint64_t>(buf, n->turn);
+			pack_put<uint8_t>(buf, n->dead);
+		}
+
+		count++;
+	}
+
+	std::memcpy(&buf[npc_count], &count, sizeof(count));
+
+	/* objects picked up are no longer on a tile */
+	count = 0;
+	std::size_t const obj_count = buf.size();
+	pack_put<uint32_t>(buf, 0);
+
+	for (int i = 1; i < g.height - 1; ++i) {
+		for (int j = 1; j < g.width - 1; ++j) {
+			obj const *const o = g.o(i, j);
+
+			if (o == NULL) {
+				continue;
+			}
+
+			pack_put<uint32_t>(buf, (uint32_t)proto_index(*o));
+			pack_put<uint16_t>(buf, (uint16_t)j);
+			pack_put<uint16_t>(buf, (uint16_t)i);
+			count++;
+		}
+	}
+
+	std::memcpy(&buf[obj_count], &count, sizeof(count));
+}
+
+/* decode a floor at buf[pos] into l, advancing pos past it */
+void
+floor_decode(std::vector<uint8_t> const &buf, std::size_t &pos, level &l)
+{
+	grid &g = l.tiles;
+	int i = 1;
+	int j = 1;
+
+	bool const exact = pack_get<uint8_t>(buf, pos);
+	int const width = pack_get<uint16_t>(buf, pos);
+	int const height = pack_get<uint16_t>(buf, pos);
+
+	g.resize(height, width);
+	l.x = pack_get<uint16_t>(buf, pos);
+	l.y = pack_get<uint16_t>(buf, pos);
+
+	l.rooms.resize(pack_get<uint32_t>(buf, pos));
+
+	for (auto &r : l.rooms) {
+		r.x = pack_get<uint16_t>(buf, pos);
+		r.y = pack_get<uint16_t>(buf, pos);
+		r.size_x = pack_get<uint16_t>(buf, pos);
+		r.size_y = pack_get<uint16_t>(buf, pos);
+	}
+
+	decode_stairs(buf, pos, l.stairs_up);
+	decode_stairs(buf, pos, l.stairs_dn);
+
+	std::fill(g.dist.begin(), g.dist.end(),
+		std::numeric_limits<int32_t>::max());
+	std::fill(g.dist_t.begin(), g.dist_t.end(),
+		std::numeric_limits<int32_t>::max());
+	std::fill(g.npc_at.begin(), g.npc_at.end(), nullptr);
+	std::fill(g.obj_at.begin(), g.obj_at.end(), nullptr);
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			if (y == 0 || x == 0 || y == height - 1
+				|| x == width - 1) {
+				g.set_h(y, x, UINT8_MAX);
+				g.c(y, x) = 0;
+				g.v(y, x) = 0;
+			}
+		}
+	}
+
+	while (i < height - 1) {
+		uint8_t const code = pack_get<uint8_t>(buf, pos);
+		uint8_t run = pack_get<uint8_t>(buf, pos);
+
+		for (; run > 0; --run) {
+			if (i == height - 1) {
+				errx(1, "floor cache runs overflow");
+			}
+
+			tile_decode(g, i, j, code);
+
+			if (++j == width - 1) {
+				j = 1;
+				i++;
+			}
+		}
+	}
+
+	for (i = 1; i < height - 1; ++i) {
+		for (j = 1; j < width - 1; ++j) {
+			if (g.c(i, j) == ROCK) {
+				g.set_h(i, j, pack_get<uint8_t>(buf, pos));
+			}
+		}
+	}
+
+	uint32_t count = pack_get<uint32_t>(buf, pos);
+
+	for (; count > 0; --count) {
+		std::size_t const proto = pack_get<uint32_t>(buf, pos);
+
+		if (proto >= npcs_parsed.size()) {
+			errx(1, "floor cache npc %zu invalid", proto);
+		}
+
+		npc *const n = new npc(npcs_parsed[proto]);
+
+		n->x = pack_get<uint16_t>(buf, pos);
+		n->y = pack_get<uint16_t>(buf, pos);
+		n->hp = pack_get<uint64_t>(buf, pos);
+		n->p_count = pack_get<uint64_t>(buf, pos);
+		n->turn = 1;
+
+		if (exact) {
+			n->turn = pack_get<uint64_t>(buf, pos);
+			n->dead = pack_get<uint8_t>(buf, pos);
+		}
+
+		/* the dead hold no tile */
+		if (!n->dead) {
+			g.n(n->y, n->x) = n;
+		}
+
+		l.npcs.push_back(n);
+	}
+
+	count = pack_get<uint32_t>(buf, pos);
+
+	for (; count > 0; --count) {
+		std::size_t const proto = pack_get<uint32_t>(buf, pos);
+
+		if (proto >= objs_parsed.size()) {
+			errx(1, "floor cache obj %zu invalid", proto);
+		}
+
+		obj *const o = new obj(objs_parsed[proto]);
+
+		o->x = pack_get<uint16_t>(buf, pos);
+		o->y = pack_get<uint16_t>(buf, pos);
+
+		g.o(o->y, o->x) = o;
+		l.objs.push_back(o);
+	}
+}
+
+static void
+encode_stairs(std::vector<uint8_t> &buf, std::vector<stair> const &stairs)
+{
+	pack_put<uint32_t>(buf, (uint32_t)stairs.size());
+
+	for (auto const &s : stairs) {
+		pack_put<uint16_t>(buf, s.x);
+		pack_put<uint16_t>(buf, s.y);
+	}
+}
+
+static void
+decode_stairs(std::vector<uint8_t> const &buf, std::size_t &pos,
+	std::vector<stair> &stairs)
+{
+	stairs.resize(pack_get<uint32_t>(buf, pos));
+
+	for (auto &s : stairs) {
+		s.x = pack_get<uint16_t>(buf, pos);
+		s.y = pack_get<uint16_t>(buf, pos);
+	}
+}
+
+static uint8_t
+tile_code(grid &g, int const y, int const x)
+{
+	for (std::size_t k = 0; k < GLYPHS_L; ++k) {
+		if (g.c(y, x) == GLYPHS[k]) {
+			return (uint8_t)(k | (g.v(y, x) ? VISITED : 0));
+		}
+	}
+
+	errx(1, "floor cache glyph '%c' unknown", (char)g.c(y, x));
+}
+
+static void
+tile_decode(grid &g, int const y, int const x, uint8_t const code)
+{
+	std::size_t const k = code & (VISITED - 1);
+
+	if (k >= GLYPHS_L) {
+		errx(1, "floor cache glyph code %zu invalid", k);
+	}
+
+	g.c(y, x) = GLYPHS[k];
+	g.v(y, x) = (code & VISITED) != 0;
+	g.set_h(y, x, 0);
+}
+
+static void
+insert(int64_t const depth, std::vector<uint8_t> &&data)
+{
+	cache_entry &e = entries[depth];
+
+	e.data = std::move(data);
+	e.data.shrink_to_fit();
+	e.size = e.data.size();
+	e.fd = -1;
+	e.spilled = false;
+
+	lru.push_front(depth);
+	e.lru = lru.begin();
+	resident += e.size;
+
+	evict();
+}
+
+/* spill the floors left longest ago until the rest fit the budget */
+static void
+evict()
+{
+	while (resident > budget && !lru.empty()) {
+		int64_t const depth = lru.back();
+
+		lru.pop_back();
+		spill(depth, entries.at(depth));
+	}
+}
+
+static std::string
+spill_path(int64_t const depth)
+{
+	return opal_dir() + "/floor." + std::to_string(getpid()) + "."
+		+ std::to_string(depth);
+}
+
+static void
+spill(int64_t const depth, cache_entry &e)
+{
+	std::string const path = spill_path(depth);
+	std::size_t off = 0;
+
+	if ((e.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600))
+		== -1) {
+		err(1, "cache open %s", path.c_str());
+	}
+
+	if (unlink(path.c_str()) == -1) {
+		err(1, "cache unlink %s", path.c_str());
+	}
+
+	while (off < e.size) {
+		ssize_t const n = write(e.fd, e.data.data() + off,
+			e.size - off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			err(1, "cache write %s", path.c_str());
+		}
+
+		off += (std::size_t)n;
+	}
+
+	resident -= e.size;
+	e.data.clear();
+	e.data.shrink_to_fit();
+	e.spilled = true;
+	spills++;
+}
+
+static void
+unspill(cache_entry &e)
+{
+	spill_read(e, e.data);
+
+	if (close(e.fd) == -1) {
+		err(1, "cache close");
+	}
+
+	e.fd = -1;
+	e.spilled = false;
+}
+
+static void
+spill_read(cache_entry const &e, std::vector<uint8_t> &data)
+{
+	std::size_t off = 0;
+
+	data.resize(e.size);
+
+	while (off < e.size) {
+		ssize_t const n = pread(e.fd, data.data() + off, e.size - off,
+			(off_t)off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			err(1, "cache pread");
+		}
+
+		if (n == 0) {
+			errx(1, "cache spill truncated");
+		}
+
+		off += (std::size_t)n;
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "globs.h"
+#include "store.h"
+
+void	cache_init(std::size_t const);
+void	cache_stop();
+
+bool	cache_has(int64_t const);
+void	cache_put(int64_t const, level &);
+bool	cache_take(int64_t const, level &);
+
+void	cache_save(std::vector<uint8_t> &, std::vector<store_splice> &);
+void	cache_load(std::vector<uint8_t> const &, std::size_t &);
+
+void	floor_encode(level &, std::vector<uint8_t> &, bool const);
+void	floor_decode(std::vector<uint8_t> const &, std::size_t &, level &);
+
+void	cache_stats(FILE *const);
+
+#endif /* CACHE_H */
@@ -0,0 +1,288 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHAMFER_X86
+#endif
+
+#include "chamfer.h"
+
+/*
+ * Distance transform of the non-tunneling map by repeated raster sweeps.
+ *
+ * A forward sweep relaxes each open tile from its up-left, up, up-right
+ * and left neighbors; a backward sweep from the mirrored four. Sweeps
+ * repeat until nothing changes, at which point every edge is relaxed and
+ * the values are exactly the breadth-first distances, without any queue.
+ *
+ * The up/down part of a sweep only reads the previous row, so it runs
+ * over whole rows in SIMD lanes. The left/right part carries a dependency
+ * from one tile to the next and stays scalar.
+ */
+
+static int32_t constexpr UNREACHED = std::numeric_limits<int32_t>::max();
+
+/* INF + 1 must not overflow */
+static int32_t constexpr INF = UNREACHED - 1;
+
+using vertical_fn = bool (*)(int32_t *const, int32_t const *const,
+	uint8_t const *const, int const);
+
+static bool	vertical_span(int32_t *const, int32_t const *const,
+	uint8_t const *const, int, int const);
+static bool	vertical_scalar(int32_t *const, int32_t const *const,
+	uint8_t const *const, int const);
+#ifdef CHAMFER_X86
+static bool	vertical_sse41(int32_t *const, int32_t const *const,
+	uint8_t const *const, int const);
+static bool	vertical_avx2(int32_t *const, int32_t const *const,
+	uint8_t const *const, int const);
+#endif
+
+static bool	scan_right(int32_t *const, uint8_t const *const, int const);
+static bool	scan_left(int32_t *const, uint8_t const *const, int const);
+
+chamfer_isa
+chamfer_detect()
+{
+#ifdef CHAMFER_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		return CHAMFER_AVX2;
+	}
+
+	if (__builtin_cpu_supports("sse4.1")) {
+		return CHAMFER_SSE41;
+	}
+#endif
+	return CHAMFER_SCALAR;
+}
+
+char const *
+chamfer_name(chamfer_isa const isa)
+{
+	switch (isa) {
+	case CHAMFER_SCALAR:
+		return "scalar";
+	case CHAMFER_SSE41:
+		return "sse4.1";
+	case CHAMFER_AVX2:
+		return "avx2";
+	}
+
+	return "unknown";
+}
+
+/*
+ * Fill the interior of the w by h map dist with distances from (sy, sx)
+ * over tiles where open is set, UNREACHED elsewhere. The border of dist is
+ * left alone.
+ */
+void
+chamfer(chamfer_isa const isa, int32_t *const dist,
+	uint8_t const *const open, int const w, int const h, int const sy,
+	int const sx)
+{
+	thread_local std::vector<int32_t> work;
+	vertical_fn vertical = vertical_scalar;
+	std::size_t const src = (std::size_t)(sy * w + sx);
+	bool changed;
+
+#ifdef CHAMFER_X86
+	if (isa == CHAMFER_AVX2) {
+		vertical = vertical_avx2;
+	} else if (isa == CHAMFER_SSE41) {
+		vertical = vertical_sse41;
+	}
+#else
+	(void)isa;
+#endif
+
+	work.assign((std::size_t)(w * h), INF);
+	work[src] = 0;
+
+	/* a PC standing in rock (DEBUG teleport) reaches nothing */
+	while (open[src]) {
+		changed = false;
+
+		for (int y = 1; y < h - 1; ++y) {
+			int32_t *const row = &work[(std::size_t)(y * w)];
+			uint8_t const *const o = open + y * w;
+
+			changed |= vertical(row, row - w, o, w);
+			changed |= scan_right(row, o, w);
+		}
+
+		for (int y = h - 2; y >= 1; --y) {
+			int32_t *const row = &work[(std::size_t)(y * w)];
+			uint8_t const *const o = open + y * w;
+
+			changed |= vertical(row, row + w, o, w);
+			changed |= scan_left(row, o, w);
+		}
+
+		if (!changed) {
+			break;
+		}
+	}
+
+	for (int y = 1; y < h - 1; ++y) {
+		for (int x = 1; x < w - 1; ++x) {
+			std::size_t const i = (std::size_t)(y * w + x);
+			dist[i] = work[i] == INF ? UNREACHED : work[i];
+		}
+	}
+}
+
+/* relax open tiles [x, end) of row from the three tiles next to them in prev */
+static bool
+vertical_span(int32_t *const row, int32_t const *const prev,
+	uint8_t const *const open, int x, int const end)
+{
+	bool changed = false;
+
+	for (; x < end; ++x) {
+		int32_t const d = std::min(std::min(prev[x - 1], prev[x]),
+			prev[x + 1]) + 1;
+
+		if (open[x] && d < row[x]) {
+			row[x] = d;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+static bool
+vertical_scalar(int32_t *const row, int32_t const *const prev,
+	uint8_t const *const open, int const w)
+{
+	return vertical_span(row, prev, open, 1, w - 1);
+}
+
+#ifdef CHAMFER_X86
+__attribute__((target("sse4.1"))) static bool
+vertical_sse41(int32_t *const row, int32_t const *const prev,
+	uint8_t const *const open, int const w)
+{
+	__m128i const one = _mm_set1_epi32(1);
+	__m128i const zero = _mm_setzero_si128();
+	__m128i changed = zero;
+	int x;
+
+	for (x = 1; x < w - 4; x += 4) {
+		int32_t o4;
+		std::memcpy(&o4, open + x, sizeof(o4));
+
+		__m128i const l = _mm_loadu_si128(
+			(__m128i_u const *)(prev + x - 1));
+		__m128i const m = _mm_loadu_si128(
+			(__m128i_u const *)(prev + x));
+		__m128i const r = _mm_loadu_si128(
+			(__m128i_u const *)(prev + x + 1));
+		__m128i const d = _mm_add_epi32(_mm_min_epi32(
+			_mm_min_epi32(l, m), r), one);
+		__m128i const o = _mm_cmpgt_epi32(
+			_mm_cvtepu8_epi32(_mm_cvtsi32_si128(o4)), zero);
+		__m128i const cur = _mm_loadu_si128(
+			(__m128i_u const *)(row + x));
+		__m128i const better = _mm_and_si128(
+			_mm_cmpgt_epi32(cur, d), o);
+
+		_mm_storeu_si128((__m128i_u *)(row + x),
+			_mm_blendv_epi8(cur, d, better));
+		changed = _mm_or_si128(changed, better);
+	}
+
+	bool const tail = vertical_span(row, prev, open, x, w - 1);
+
+	return !_mm_testz_si128(changed, changed) || tail;
+}
+
+__attribute__((target("avx2"))) static bool
+vertical_avx2(int32_t *const row, int32_t const *const prev,
+	uint8_t const *const open, int const w)
+{
+	__m256i const one = _mm256_set1_epi32(1);
+	__m256i const zero = _mm256_setzero_si256();
+	__m256i changed = zero;
+	int x;
+
+	for (x = 1; x < w - 8; x += 8) {
+		__m256i const l = _mm256_loadu_si256(
+			(__m256i_u const *)(prev + x - 1));
+		__m256i const m = _mm256_loadu_si256(
+			(__m256i_u const *)(prev + x));
+		__m256i const r = _mm256_loadu_si256(
+			(__m256i_u const *)(prev + x + 1));
+		__m256i const d = _mm256_add_epi32(_mm256_min_epi32(
+			_mm256_min_epi32(l, m), r), one);
+		__m256i const o = _mm256_cmpgt_epi32(
+			_mm256_cvtepu8_epi32(_mm_loadu_si64(open + x)), zero);
+		__m256i const cur = _mm256_loadu_si256(
+			(__m256i_u const *)(row + x));
+		__m256i const better = _mm256_and_si256(
+			_mm256_cmpgt_epi32(cur, d), o);
+
+		_mm256_storeu_si256((__m256i_u *)(row + x),
+			_mm256_blendv_epi8(cur, d, better));
+		changed = _mm256_or_si256(changed, better);
+	}
+
+	bool const tail = vertical_span(row, prev, open, x, w - 1);
+
+	return !_mm256_testz_si256(changed, changed) || tail;
+}
+#endif
+
+static bool
+scan_right(int32_t *const row, uint8_t const *const open, int const w)
+{
+	bool changed = false;
+
+	for (int x = 2; x < w - 1; ++x) {
+		if (open[x] && row[x - 1] + 1 < row[x]) {
+			row[x] = row[x - 1] + 1;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+static bool
+scan_left(int32_t *const row, uint8_t const *const open, int const w)
+{
+	bool changed = false;
+
+	for (int x = w - 3; x >= 1; --x) {
+		if (open[x] && row[x + 1] + 1 < row[x]) {
+			row[x] = row[x + 1] + 1;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
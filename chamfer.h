@@ -0,0 +1,35 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CHAMFER_H
+#define CHAMFER_H
+
+#include <cstdint>
+
+enum chamfer_isa {
+	CHAMFER_SCALAR,
+	CHAMFER_SSE41,
+	CHAMFER_AVX2
+};
+
+chamfer_isa	chamfer_detect();
+char const	*chamfer_name(chamfer_isa const);
+
+void	chamfer(chamfer_isa const, int32_t *const, uint8_t const *const,
+	int const, int const, int const, int const);
+
+#endif /* CHAMFER_H */
@@ -0,0 +1,438 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "desc.h"
+#include "dice.h"
+#include "gen.h"
+#include "globs.h"
+#include "pack.h"
+#include "parse.h"
+#include "store.h"
+
+/*
+ * With large description files, parsing them is most of startup, so what
+ * the parser made of them is kept in a pack next to them, keyed by the
+ * size, modification time and hash of each file. Sizes and times that
+ * match are trusted; otherwise the file is hashed, so one that was only
+ * touched still uses the pack. Names and descriptions are viewed in the
+ * mapped pack, not copied out. Values in dice format are packed as dice
+ * and rolled every game, as parsing does.
+ */
+struct source {
+	char const	*file;
+	struct stat	st;
+	uint64_t	hash;
+};
+
+using sources = source[2];
+
+static bool	load_pack(sources &, bool &);
+static bool	read_pack(uint8_t const *const, std::size_t const, sources &,
+	bool &);
+static void	save_pack(sources const &);
+static void	roll();
+
+static uint64_t	hash_file(char const *const);
+
+static void	put_dice(std::vector<uint8_t> &, dice const &);
+static void	put_string(std::vector<uint8_t> &, std::string_view const);
+static bool	get_dice(uint8_t const *const, std::size_t const,
+	std::size_t &, dice &);
+static bool	get_string(uint8_t const *const, std::size_t const,
+	std::size_t &, std::string_view &);
+
+static char const *const FILEPATH = "/desc_pack";
+
+static char const *const MARK = "OPAL-DESC";
+static std::size_t constexpr MARK_L = 9;
+
+static uint32_t constexpr DESC_VERSION = 0;
+
+/* marker, version, and size, mtime and hash of both files */
+static std::size_t constexpr HEADER_L = MARK_L + sizeof(uint32_t)
+	+ 2 * 4 * sizeof(uint64_t);
+
+/* the least a description packs: two empty strings and its damage */
+static std::size_t constexpr PROTO_MIN_L = 2 * sizeof(uint32_t)
+	+ 3 * sizeof(uint64_t);
+
+static bool from_pack;
+
+/* the descriptions, from the pack if it is current, rolled for this game */
+void
+desc_load()
+{
+	sources src = { { NPC_FILE, {}, 0 }, { OBJ_FILE, {}, 0 } };
+	bool stale = false;
+
+	for (auto &s : src) {
+		std::string const path = opal_path() + s.file;
+
+		if (stat(path.c_str(), &s.st) == -1) {
+			err(1, "description file %s", path.c_str());
+		}
+	}
+
+	from_pack = load_pack(src, stale);
+
+	if (!from_pack) {
+		parse_files();
+
+		for (auto &s : src) {
+			s.hash = hash_file(s.file);
+		}
+	}
+
+	if (!from_pack || stale) {
+		save_pack(src);
+	}
+
+	roll();
+}
+
+void
+desc_stats(FILE *const f)
+{
+	(void)fprintf(f, "descriptions: %zu npcs, %zu objects, %s\n",
+		npcs_parsed.size(), objs_parsed.size(),
+		from_pack ? "from pack" : "parsed");
+	parse_stats(f);
+}
+
+static bool
+load_pack(sources &src, bool &stale)
+{
+	struct stat st;
+	void *map;
+	int fd;
+	bool ret;
+
+	std::string const path = opal_path() + FILEPATH;
+
+	if ((fd = open(path.c_str(), O_RDONLY)) == -1) {
+		if (errno == ENOENT) {
+			return false;
+		}
+
+		err(1, "desc open");
+	}
+
+	if (fstat(fd, &st) == -1) {
+		err(1, "desc fstat");
+	}
+
+	/* too short for a header, and mmap(2) refuses empty files */
+	if ((std::size_t)st.st_size < HEADER_L) {
+		(void)close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+		0);
+
+	if (map == MAP_FAILED) {
+		err(1, "desc mmap");
+	}
+
+	if (close(fd) == -1) {
+		err(1, "desc close");
+	}
+
+	ret = read_pack(static_cast<uint8_t const *>(map),
+		(std::size_t)st.st_size, src, stale);
+
+	/* in use, the names and descriptions view it */
+	if (ret) {
+		return true;
+	}
+
+	/* a pack read part way is dropped with the mapping it views */
+	npcs_parsed.clear();
+	npc_rolls.clear();
+	objs_parsed.clear();
+	obj_rolls.clear();
+
+	if (munmap(map, (std::size_t)st.st_size) == -1) {
+		err(1, "desc munmap");
+	}
+
+	return false;
+}
+
+/*
+ * false if the pack is of other files or another version, or is truncated
+ * or corrupt; it is only a cache, so it is then parsed again and replaced
+ */
+static bool
+read_pack(uint8_t const *const buf, std::size_t const len, sources &src,
+	bool &stale)
+{
+	std::size_t pos = MARK_L;
+	uint32_t version, count;
+
+	if (std::memcmp(buf, MARK, MARK_L) != 0
+		|| !pack_take<uint32_t>(buf, len, pos, version)
+		|| version != DESC_VERSION) {
+		return false;
+	}
+
+	for (auto &s : src) {
+		uint64_t size;
+		int64_t sec, nsec;
+
+		if (!pack_take<uint64_t>(buf, len, pos, size)
+			|| !pack_take<int64_t>(buf, len, pos, sec)
+			|| !pack_take<int64_t>(buf, len, pos, nsec)
+			|| !pack_take<uint64_t>(buf, len, pos, s.hash)) {
+			return false;
+		}
+
+		if (size != (uint64_t)s.st.st_size) {
+			return false;
+		}
+
+		if (sec == s.st.st_mtim.tv_sec
+			&& nsec == s.st.st_mtim.tv_nsec) {
+			continue;
+		}
+
+		if (hash_file(s.file) != s.hash) {
+			return false;
+		}
+
+		stale = true;
+	}
+
+	if (!pack_take<uint32_t>(buf, len, pos, count)
+		|| count > (len - pos) / PROTO_MIN_L) {
+		return false;
+	}
+
+	npcs_parsed.resize(count);
+	npc_rolls.resize(count);
+
+	for (std::size_t i = 0; i < count; ++i) {
+		npc_proto &n = npcs_parsed[i];
+
+		if (!get_string(buf, len, pos, n.name)
+			|| !get_string(buf, len, pos, n.desc)
+			|| !pack_take<int32_t>(buf, len, pos, n.color)
+			|| !get_dice(buf, len, pos, n.dam)
+			|| !pack_take<uint32_t>(buf, len, pos, n.symb)
+			|| !pack_take<uint8_t>(buf, len, pos, n.rrty)
+			|| n.rrty == 0 || n.rrty > 100
+			|| !pack_take<uint16_t>(buf, len, pos, n.type)) {
+			return false;
+		}
+
+		for (auto &d : npc_rolls[i]) {
+			if (!get_dice(buf, len, pos, d)) {
+				return false;
+			}
+		}
+	}
+
+	if (!pack_take<uint32_t>(buf, len, pos, count)
+		|| count > (len - pos) / PROTO_MIN_L) {
+		return false;
+	}
+
+	objs_parsed.resize(count);
+	obj_rolls.resize(count);
+
+	for (std::size_t i = 0; i < count; ++i) {
+		obj_proto &o = objs_parsed[i];
+		uint8_t t;
+
+		if (!get_string(buf, len, pos, o.name)
+			|| !get_string(buf, len, pos, o.desc)
+			|| !pack_take<int32_t>(buf, len, pos, o.color)
+			|| !get_dice(buf, len, pos, o.dam)
+			|| !pack_take<uint32_t>(buf, len, pos, o.symb)
+			|| !pack_take<uint8_t>(buf, len, pos, o.rrty)
+			|| o.rrty == 0 || o.rrty > 100
+			|| !pack_take<uint8_t>(buf, len, pos, t)
+			|| t > weapon
+			|| !pack_take<uint8_t>(buf, len, pos, o.art)) {
+			return false;
+		}
+
+		o.obj_type = (type)t;
+
+		for (auto &d : obj_rolls[i]) {
+			if (!get_dice(buf, len, pos, d)) {
+				return false;
+			}
+		}
+	}
+
+	return pos == len;
+}
+
+static void
+save_pack(sources const &src)
+{
+	std::vector<uint8_t> buf(MARK, MARK + MARK_L);
+
+	pack_put<uint32_t>(buf, DESC_VERSION);
+
+	for (auto const &s : src) {
+		pack_put<uint64_t>(buf, (uint64_t)s.st.st_size);
+		pack_put<int64_t>(buf, s.st.st_mtim.tv_sec);
+		pack_put<int64_t>(buf, s.st.st_mtim.tv_nsec);
+		pack_put<uint64_t>(buf, s.hash);
+	}
+
+	pack_put<uint32_t>(buf, (uint32_t)npcs_parsed.size());
+
+	for (std::size_t i = 0; i < npcs_parsed.size(); ++i) {
+		npc_proto const &n = npcs_parsed[i];
+
+		put_string(buf, n.name);
+		put_string(buf, n.desc);
+		pack_put<int32_t>(buf, n.color);
+		put_dice(buf, n.dam);
+		pack_put<uint32_t>(buf, n.symb);
+		pack_put<uint8_t>(buf, n.rrty);
+		pack_put<uint16_t>(buf, n.type);
+
+		for (auto const &d : npc_rolls[i]) {
+			put_dice(buf, d);
+		}
+	}
+
+	pack_put<uint32_t>(buf, (uint32_t)objs_parsed.size());
+
+	for (std::size_t i = 0; i < objs_parsed.size(); ++i) {
+		obj_proto const &o = objs_parsed[i];
+
+		put_string(buf, o.name);
+		put_string(buf, o.desc);
+		pack_put<int32_t>(buf, o.color);
+		put_dice(buf, o.dam);
+		pack_put<uint32_t>(buf, o.symb);
+		pack_put<uint8_t>(buf, o.rrty);
+		pack_put<uint8_t>(buf, (uint8_t)o.obj_type);
+		pack_put<uint8_t>(buf, o.art);
+
+		for (auto const &d : obj_rolls[i]) {
+			put_dice(buf, d);
+		}
+	}
+
+	store_write(opal_dir() + FILEPATH, std::move(buf));
+}
+
+/* from a stream of their own, so the rest of the game draws the same */
+static void
+roll()
+{
+	ranged_random values = rr.stream(STREAM_PARSE, 0);
+
+	for (std::size_t i = 0; i < npcs_parsed.size(); ++i) {
+		npc_proto &n = npcs_parsed[i];
+		npc_dice const &d = npc_rolls[i];
+
+		n.hp = dice_roll(values, d[NPC_HP]);
+		n.speed = dice_roll(values, d[NPC_SPEED]);
+	}
+
+	for (std::size_t i = 0; i < objs_parsed.size(); ++i) {
+		obj_proto &o = objs_parsed[i];
+		obj_dice const &d = obj_rolls[i];
+
+		o.attr = dice_roll(values, d[OBJ_ATTR]);
+		o.def = dice_roll(values, d[OBJ_DEF]);
+		o.dodge = dice_roll(values, d[OBJ_DODGE]);
+		o.hit = dice_roll(values, d[OBJ_HIT]);
+		o.speed = dice_roll(values, d[OBJ_SPEED]);
+		o.val = dice_roll(values, d[OBJ_VAL]);
+	}
+}
+
+/* FNV-1a */
+static uint64_t
+hash_file(char const *const file)
+{
+	std::vector<uint8_t> buf;
+	uint64_t h = 0xCBF29CE484222325;
+
+	if (!store_read(opal_path() + file, buf, SIZE_MAX)) {
+		err(1, "description file %s", file);
+	}
+
+	for (auto const b : buf) {
+		h = (h ^ b) * 0x100000001B3;
+	}
+
+	return h;
+}
+
+static void
+put_dice(std::vector<uint8_t> &buf, dice const &d)
+{
+	pack_put<uint64_t>(buf, d.base);
+	pack_put<uint64_t>(buf, d.dice);
+	pack_put<uint64_t>(buf, d.sides);
+}
+
+static void
+put_string(std::vector<uint8_t> &buf, std::string_view const s)
+{
+	pack_put<uint32_t>(buf, (uint32_t)s.size());
+	buf.insert(buf.end(), s.begin(), s.end());
+}
+
+static bool
+get_dice(uint8_t const *const buf, std::size_t const len, std::size_t &pos,
+	dice &d)
+{
+	return pack_take<uint64_t>(buf, len, pos, d.base)
+		&& pack_take<uint64_t>(buf, len, pos, d.dice)
+		&& pack_take<uint64_t>(buf, len, pos, d.sides);
+}
+
+/* a view of the pack, which stays mapped */
+static bool
+get_string(uint8_t const *const buf, std::size_t const len, std::size_t &pos,
+	std::string_view &s)
+{
+	uint32_t n;
+
+	if (!pack_take<uint32_t>(buf, len, pos, n) || len - pos < n) {
+		return false;
+	}
+
+	s = std::string_view(reinterpret_cast<char const *>(buf + pos), n);
+	pos += n;
+
+	return true;
+}
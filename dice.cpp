@@ -0,0 +1,137 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cinttypes>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "alias.h"
+#include "dice.h"
+
+/*
+ * The sum of n dice of s sides, tabulated once per (n, s) so that a roll
+ * costs two draws however many dice there are.
+ *
+ * Weights are the exact counts of each sum out of s^n outcomes. Specs
+ * whose counts would not fit are rolled die by die as before.
+ */
+static bool	build(alias_table &, uint64_t const, uint64_t const);
+
+/* sums past this many are not worth a table */
+static std::size_t constexpr SUMS_MAX = 1 << 16;
+
+/* keyed by dice << 32 | sides, main thread only */
+static std::unordered_map<uint64_t, alias_table> tables;
+static std::size_t sums;
+
+uint64_t
+dice_roll(ranged_random &r, dice const &d)
+{
+	if (d.dice == 0) {
+		return d.base;
+	}
+
+	if (d.dice == 1) {
+		return d.base + r.rrand<uint64_t>(1, d.sides);
+	}
+
+	if (d.dice > UINT32_MAX || d.sides > UINT32_MAX) {
+		return r.rand_dice<uint64_t>(d.base, d.dice, d.sides);
+	}
+
+	uint64_t const key = d.dice << 32 | d.sides;
+	auto it = tables.find(key);
+
+	if (it == tables.end()) {
+		it = tables.emplace(key, alias_table()).first;
+
+		(void)build(it->second, d.dice, d.sides);
+		sums += it->second.prob.size();
+	}
+
+	if (it->second.prob.empty()) {
+		return r.rand_dice<uint64_t>(d.base, d.dice, d.sides);
+	}
+
+	/* the smallest sum is one per die */
+	return d.base + d.dice + alias_draw(it->second, r);
+}
+
+double
+dice_mean(dice const &d)
+{
+	return (double)d.base + (double)d.dice * ((double)d.sides + 1) / 2;
+}
+
+double
+dice_variance(dice const &d)
+{
+	double const s = (double)d.sides;
+
+	return (double)d.dice * (s * s - 1) / 12;
+}
+
+void
+dice_stats(FILE *const f)
+{
+	(void)fprintf(f, "dice tables: %zu, %zu sums\n", tables.size(), sums);
+}
+
+static bool
+build(alias_table &t, uint64_t const n, uint64_t const s)
+{
+	std::vector<uint64_t> count(1, 1);
+	std::vector<uint64_t> next;
+	uint64_t outcomes = 1;
+
+	if (s < 2 || (s - 1) > (SUMS_MAX - 1) / n) {
+		return false;
+	}
+
+	/* s^n outcomes, the largest count, must fit */
+	for (uint64_t k = 0; k < n; ++k) {
+		if (outcomes > UINT64_MAX / s) {
+			return false;
+		}
+
+		outcomes *= s;
+	}
+
+	/* add one die at a time, a sliding window sum over s counts */
+	for (uint64_t k = 0; k < n; ++k) {
+		uint64_t window = 0;
+
+		next.assign(count.size() + s - 1, 0);
+
+		for (std::size_t i = 0; i < next.size(); ++i) {
+			if (i < count.size()) {
+				window += count[i];
+			}
+
+			if (i >= s) {
+				window -= count[i - s];
+			}
+
+			next[i] = window;
+		}
+
+		std::swap(count, next);
+	}
+
+	return alias_build(t, count);
+}
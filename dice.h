@@ -0,0 +1,33 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DICE_H
+#define DICE_H
+
+#include <cstdint>
+#include <cstdio>
+
+#include "globs.h"
+
+uint64_t	dice_roll(ranged_random &, dice const &);
+
+double	dice_mean(dice const &);
+double	dice_variance(dice const &);
+
+void	dice_stats(FILE *const);
+
+#endif /* DICE_H */
@@ -16,134 +16,361 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include <algorithm>
-#include <functional>
-#include <thread>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include <err.h>
+
+#include "chamfer.h"
+#include "dijk.h"
 #include "globs.h"
+#include "pool.h"
 
+static void	dijkstra();
 static void	dijkstra_d();
 static void	dijkstra_dt();
 
-static void constexpr	calc_cost_d(tile const &, tile &);
-static void constexpr	calc_cost_dt(tile const &, tile &);
+static void	fill_d(grid &, std::size_t const);
+static void	fill_dt(grid &, std::size_t const);
+static void	bfs_d(grid &, std::size_t const);
+
+/*
+ * Tunneling edges cost 1 + h/TUNNEL_STRENGTH, at most COST_MAX. Every live
+ * tentative distance lies within COST_MAX of the one being drained, so a
+ * ring of COST_MAX + 1 buckets is enough (Dial's algorithm).
+ */
+static int32_t constexpr COST_MAX = 1 + UINT8_MAX / TUNNEL_STRENGTH;
+static std::size_t constexpr BUCKETS = COST_MAX + 1;
+static int32_t constexpr UNREACHED = std::numeric_limits<int32_t>::max();
+
+using bucket_ring = std::array<std::vector<std::size_t>, BUCKETS>;
+
+static std::array<std::ptrdiff_t, 8>	neighbors(grid const &);
+
+static void	drain_d(grid &, std::size_t);
+static void	drain_dt(grid &, int32_t);
+
+static void	relax_d(grid &, std::size_t const);
+static void	relax_dt(grid &, std::size_t const);
+
+/* scratch per thread, as floors are also mapped off the main thread */
+static thread_local std::vector<std::size_t> queue;
+static thread_local bucket_ring buckets;
+
+/* non-tunneling backend */
+static bool transform;
+static chamfer_isa isa;
+
+static pool_job job_d = { "dijkstra_d", dijkstra_d, {}, {}, {} };
+static pool_job job_dt = { "dijkstra_dt", dijkstra_dt, {}, {}, {} };
+
+/*
+ * The maps are versioned against a generation counter which advances when
+ * the PC moves or the floor is replaced. A map whose stamp lags behind is
+ * stale and is only rebuilt once an NPC actually reads it.
+ */
+static uint64_t generation = 1;
+static uint64_t stamp_d;
+static uint64_t stamp_dt;
+
+/* whether the floor in play has NPCs reading each map, see dijkstra_want */
+static bool want_d;
+static bool want_dt;
+
+/* select the distance transform instead of BFS for the non-tunneling map */
+void
+dijkstra_init(bool const use_transform)
+{
+	transform = use_transform;
+	isa = chamfer_detect();
+}
 
-struct compare_d {
-	bool constexpr
-	operator() (tile const &a, tile const &b) const
-	{
-		return a.d > b.d;
+/*
+ * Which maps the NPCs of the floor in play read. With both read, a stale
+ * read of one rebuilds the other alongside it, as it is soon read too.
+ * A map rebuilt alone is filled on the calling thread.
+ */
+void
+dijkstra_want(bool const d, bool const dt)
+{
+	want_d = d;
+	want_dt = dt;
+}
+
+void
+dijkstra_ensure_d()
+{
+	if (stamp_d == generation) {
+		return;
 	}
-};
 
-struct compare_dt {
-	bool constexpr
-	operator() (tile const &a, tile const &b) const
-	{
-		return a.dt > b.dt;
+	if (want_dt && stamp_dt != generation) {
+		dijkstra();
+		return;
 	}
-};
+
+	pool_run(job_d);
+	stamp_d = generation;
+}
 
 void
-dijkstra()
+dijkstra_ensure_dt()
 {
-	std::thread t1(dijkstra_d);
-	std::thread t2(dijkstra_dt);
+	if (stamp_dt == generation) {
+		return;
+	}
+
+	if (want_d && stamp_d != generation) {
+		dijkstra();
+		return;
+	}
 
-	t1.join();
-	t2.join();
+	pool_run(job_dt);
+	stamp_dt = generation;
 }
 
-static void
-dijkstra_d()
+void
+dijkstra_invalidate()
 {
-	std::vector<std::reference_wrapper<tile>> heap;
+	generation++;
+}
 
-	for (std::size_t i = 1; i < HEIGHT - 1; ++i) {
-		for (std::size_t j = 1; j < WIDTH - 1; ++j) {
-			tiles[i][j].d = std::numeric_limits<int32_t>::max();
+/* fill both maps of a floor that is not in play yet, on the calling thread */
+void
+dijkstra_fill(grid &g, uint16_t const y, uint16_t const x)
+{
+	fill_d(g, g.at(y, x));
+	fill_dt(g, g.at(y, x));
+}
+
+/* tiles was just swapped in with maps filled for the PC */
+void
+dijkstra_adopt()
+{
+	generation++;
+	stamp_d = generation;
+	stamp_dt = generation;
+}
 
-			if (tiles[i][j].h == 0) {
-				tiles[i][j].vd = true;
-				heap.push_back(tiles[i][j]);
+void
+dijkstra_stats(FILE *const f)
+{
+	(void)fprintf(f, "dijkstra_d backend: %s\n",
+		transform ? chamfer_name(isa) : "bfs");
+	pool_print(f, job_d);
+	pool_print(f, job_dt);
+}
+
+/*
+ * The hardness of tiles[y][x] was lowered. That can only shorten paths: the
+ * tile may open up for the non-tunneling map, and its outgoing tunneling
+ * edges got cheaper. Both maps are repaired with a decrease-only wave
+ * seeded at the tile, touching just the tiles whose distance improved.
+ */
+void
+dijkstra_repair(uint16_t const y, uint16_t const x)
+{
+	std::size_t const t = tiles.at(y, x);
+	std::vector<int32_t> &dist = tiles.dist;
+
+	/* stale maps are rebuilt from scratch when read */
+	if (tiles.passable[t] && stamp_d == generation) {
+		for (auto const off : neighbors(tiles)) {
+			std::size_t const n = t + (std::size_t)off;
+
+			if (tiles.passable[n] && dist[n] != UNREACHED
+				&& dist[t] > dist[n] + 1) {
+				dist[t] = dist[n] + 1;
 			}
 		}
+
+		if (dist[t] != UNREACHED) {
+			queue.clear();
+			queue.push_back(t);
+			drain_d(tiles, 0);
+		}
 	}
 
-	tiles[player.y][player.x].d = 0;
+	if (stamp_dt != generation) {
+		return;
+	}
 
-	while (!heap.empty()) {
-		std::make_heap(heap.begin(), heap.end(), compare_d());
+	for (auto &b : buckets) {
+		b.clear();
+	}
 
-		tile &t = heap.front();
-		std::pop_heap(heap.begin(), heap.end(), compare_d());
-		heap.pop_back();
+	relax_dt(tiles, t);
+	drain_dt(tiles, tiles.dist_t[t] + 1);
+}
 
-		calc_cost_d(t, tiles[t.y - 1][t.x + 0]);
-		calc_cost_d(t, tiles[t.y + 1][t.x + 0]);
+/* rebuild both stale maps in parallel */
+static void
+dijkstra()
+{
+	pool_token token(2);
 
-		calc_cost_d(t, tiles[t.y + 0][t.x - 1]);
-		calc_cost_d(t, tiles[t.y + 0][t.x + 1]);
+	pool_submit(job_d, token);
+	pool_submit(job_dt, token);
+	pool_wait(token);
 
-		calc_cost_d(t, tiles[t.y + 1][t.x + 1]);
-		calc_cost_d(t, tiles[t.y - 1][t.x - 1]);
+	stamp_d = generation;
+	stamp_dt = generation;
+}
 
-		calc_cost_d(t, tiles[t.y - 1][t.x + 1]);
-		calc_cost_d(t, tiles[t.y + 1][t.x - 1]);
+static void
+dijkstra_d()
+{
+	fill_d(tiles, tiles.at(player.y, player.x));
+}
 
-		t.vd = false;
+static void
+dijkstra_dt()
+{
+	fill_dt(tiles, tiles.at(player.y, player.x));
+}
+
+static void
+fill_d(grid &g, std::size_t const src)
+{
+	if (!transform) {
+		bfs_d(g, src);
+		return;
 	}
+
+	chamfer(isa, g.dist.data(), g.passable.data(), g.width, g.height,
+		(int)(src / (std::size_t)g.width),
+		(int)(src % (std::size_t)g.width));
+
+#ifdef DEBUG
+	thread_local std::vector<int32_t> check;
+	check = g.dist;
+
+	bfs_d(g, src);
+
+	if (check != g.dist) {
+		errx(1, "%s distance transform disagrees with bfs",
+			chamfer_name(isa));
+	}
+#endif
 }
 
 static void
-dijkstra_dt()
+fill_dt(grid &g, std::size_t const src)
 {
-	std::vector<std::reference_wrapper<tile>> heap;
-	heap.reserve((HEIGHT - 1) * (WIDTH - 1));
+	for (auto &b : buckets) {
+		b.clear();
+	}
 
-	for (std::size_t i = 1; i < HEIGHT - 1; ++i) {
-		for (std::size_t j = 1; j < WIDTH - 1; ++j) {
-			tiles[i][j].dt = std::numeric_limits<int32_t>::max();
-			tiles[i][j].vdt = true;
-			heap.push_back(tiles[i][j]);
-		}
+	for (int i = 1; i < g.height - 1; ++i) {
+		std::fill_n(&g.dist_t[g.at(i, 1)], g.width - 2, UNREACHED);
+	}
+
+	g.dist_t[src] = 0;
+	buckets[0].push_back(src);
+
+	drain_dt(g, 0);
+}
+
+/* uniform edge costs: breadth-first order is Dijkstra order */
+static void
+bfs_d(grid &g, std::size_t const src)
+{
+	queue.clear();
+	queue.reserve((std::size_t)((g.height - 2) * (g.width - 2)));
+
+	for (int i = 1; i < g.height - 1; ++i) {
+		std::fill_n(&g.dist[g.at(i, 1)], g.width - 2, UNREACHED);
 	}
 
-	tiles[player.y][player.x].dt = 0;
+	g.dist[src] = 0;
 
-	while (!heap.empty()) {
-		std::make_heap(heap.begin(), heap.end(), compare_dt());
+	/* a PC standing in rock (DEBUG teleport) reaches nothing */
+	if (g.passable[src]) {
+		queue.push_back(src);
+	}
 
-		tile &t = heap.front();
-		std::pop_heap(heap.begin(), heap.end(), compare_dt());
-		heap.pop_back();
+	drain_d(g, 0);
+}
 
-		calc_cost_dt(t, tiles[t.y - 1][t.x + 0]);
-		calc_cost_dt(t, tiles[t.y + 1][t.x + 0]);
+static void
+drain_d(grid &g, std::size_t head)
+{
+	for (; head < queue.size(); ++head) {
+		relax_d(g, queue[head]);
+	}
+}
 
-		calc_cost_dt(t, tiles[t.y + 0][t.x - 1]);
-		calc_cost_dt(t, tiles[t.y + 0][t.x + 1]);
+static void
+drain_dt(grid &g, int32_t cur)
+{
+	std::size_t empty = 0;
 
-		calc_cost_dt(t, tiles[t.y + 1][t.x + 1]);
-		calc_cost_dt(t, tiles[t.y - 1][t.x - 1]);
+	for (; empty < BUCKETS; ++cur) {
+		auto &b = buckets[(std::size_t)cur % BUCKETS];
 
-		calc_cost_dt(t, tiles[t.y - 1][t.x + 1]);
-		calc_cost_dt(t, tiles[t.y + 1][t.x - 1]);
+		if (b.empty()) {
+			empty++;
+			continue;
+		}
 
-		t.vdt = false;
+		empty = 0;
+
+		/* relax_dt never pushes into the bucket being drained */
+		for (auto const t : b) {
+			/* skip entries lowered into an earlier bucket since */
+			if (g.dist_t[t] == cur) {
+				relax_dt(g, t);
+			}
+		}
+
+		b.clear();
 	}
 }
 
-static void constexpr
-calc_cost_d(tile const &a, tile &b)
+static void
+relax_d(grid &g, std::size_t const a)
 {
-	if (b.vd && b.d > a.d) {
-		b.d = a.d + 1;
+	int32_t const d = g.dist[a] + 1;
+
+	for (auto const off : neighbors(g)) {
+		std::size_t const b = a + (std::size_t)off;
+
+		/* border tiles are never open */
+		if (g.passable[b] && g.dist[b] > d) {
+			g.dist[b] = d;
+			queue.push_back(b);
+		}
 	}
 }
 
-static void constexpr
-calc_cost_dt(tile const &a, tile &b)
+static void
+relax_dt(grid &g, std::size_t const a)
 {
-	if (b.vdt && b.dt > a.dt + a.h/TUNNEL_STRENGTH) {
-		b.dt = a.dt + 1 + a.h/TUNNEL_STRENGTH;
+	int32_t const dt = g.dist_t[a] + 1 + g.hardness[a]/TUNNEL_STRENGTH;
+	int const ay = (int)(a / (std::size_t)g.width);
+	int const ax = (int)(a % (std::size_t)g.width);
+
+	/* the border is not part of the map */
+	for (int y = std::max(ay - 1, 1); y <= std::min(ay + 1, g.height - 2);
+		++y) {
+		for (int x = std::max(ax - 1, 1);
+			x <= std::min(ax + 1, g.width - 2); ++x) {
+			std::size_t const b = g.at(y, x);
+
+			if (g.dist_t[b] > dt) {
+				g.dist_t[b] = dt;
+				buckets[(std::size_t)dt % BUCKETS].push_back(b);
+			}
+		}
 	}
 }
+
+/* index offsets of the 8 neighbors of a tile */
+static std::array<std::ptrdiff_t, 8>
+neighbors(grid const &g)
+{
+	std::ptrdiff_t const w = g.width;
+
+	return {{ -w - 1, -w, -w + 1, -1, 1, w - 1, w, w + 1 }};
+}
@@ -18,6 +18,19 @@
 #ifndef DIJK_H
 #define DIJK_H
 
-void	dijkstra();
+#include <cstdint>
+#include <cstdio>
+
+struct grid;
+
+void	dijkstra_init(bool const);
+void	dijkstra_want(bool const, bool const);
+void	dijkstra_ensure_d();
+void	dijkstra_ensure_dt();
+void	dijkstra_invalidate();
+void	dijkstra_fill(grid &, uint16_t const, uint16_t const);
+void	dijkstra_adopt();
+void	dijkstra_repair(uint16_t const, uint16_t const);
+void	dijkstra_stats(FILE *const);
 
 #endif /* DIJK_H */
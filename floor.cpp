@@ -15,84 +15,202 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <vector>
+
+#include "floor.h"
 #include "globs.h"
 
-static bool	valid_room(room const &);
-static int	valid_corridor_x(int const, int const);
-static int	valid_corridor_y(int const, int const);
-static int	valid_stair(int const, int const);
+static uint64_t	word_mask(int const, int const, int const);
+static bool	valid_room(grid const &, room_bits const &, room const &);
+static int	valid_corridor_x(grid &, int const, int const);
+static int	valid_corridor_y(grid &, int const, int const);
+static int	valid_stair(grid &, int const, int const);
 
 static int constexpr MINROOMH = 4;
 static int constexpr MINROOMW = 3;
 static int constexpr MAXROOMH = 8;
 static int constexpr MAXROOMW = 15;
 
+/* g has only rock inside its border */
+void
+room_bits::reset(grid const &g)
+{
+	width = g.width;
+	stride = ((std::size_t)g.width + 63) / 64;
+	bits.assign(stride * (std::size_t)g.height, 0);
+
+	set(0, 0, g.width - 1);
+	set(g.height - 1, 0, g.width - 1);
+
+	for (int i = 1; i < g.height - 1; ++i) {
+		set(i, 0, 0);
+		set(i, g.width - 1, g.width - 1);
+	}
+}
+
+/* cells x0 to x1 of row y */
+void
+room_bits::set(int const y, int const x0, int const x1)
+{
+	uint64_t *const row = &bits[(std::size_t)y * stride];
+
+	for (int w = x0 / 64; w <= x1 / 64; ++w) {
+		row[w] |= word_mask(w, x0, x1);
+	}
+}
+
 bool
-gen_room(room &r)
+room_bits::clear(int const y, int const x0, int const x1) const
 {
-	r.x = rr.rrand<uint8_t>(1, WIDTH - 2);
-	r.y = rr.rrand<uint8_t>(1, HEIGHT - 2);
-	r.size_x = rr.rrand<uint8_t>(MINROOMW, MAXROOMW);
-	r.size_y = rr.rrand<uint8_t>(MINROOMH, MAXROOMH);
+	uint64_t const *const row = &bits[(std::size_t)y * stride];
 
-	return valid_room(r);
+	/* past the border */
+	if (x1 >= width) {
+		return false;
+	}
+
+	for (int w = x0 / 64; w <= x1 / 64; ++w) {
+		if (row[w] & word_mask(w, x0, x1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+gen_room(grid &g, room_bits const &occ, ranged_random &r, room &rm)
+{
+	rm.x = r.rrand<uint16_t>(1, (uint16_t)(g.width - 2));
+	rm.y = r.rrand<uint16_t>(1, (uint16_t)(g.height - 2));
+	rm.size_x = r.rrand<uint16_t>(MINROOMW, MAXROOMW);
+	rm.size_y = r.rrand<uint16_t>(MINROOMH, MAXROOMH);
+
+	return valid_room(g, occ, rm);
 }
 
 void
-draw_room(room const &r)
+draw_room(grid &g, room const &r)
 {
-	for (int i = r.x; i < r.x + r.size_x; ++i) {
-		for (int j = r.y; j < r.y + r.size_y; ++j) {
-			tiles[j][i].c = ROOM;
-			tiles[j][i].h = 0;
+	for (int j = r.y; j < r.y + r.size_y; ++j) {
+		for (int i = r.x; i < r.x + r.size_x; ++i) {
+			g.c(j, i) = ROOM;
+			g.set_h(j, i, 0);
 		}
 	}
 }
 
+void
+draw_room(grid &g, room_bits &occ, room const &r)
+{
+	draw_room(g, r);
+
+	for (int j = r.y; j < r.y + r.size_y; ++j) {
+		occ.set(j, r.x, r.x + r.size_x - 1);
+	}
+}
+
 
 void
-gen_corridor(room const &r1, room const &r2)
+gen_corridor(grid &g, room const &r1, room const &r2)
 {
 	for (int i = std::min(r1.x, r2.x); i <= std::max(r1.x, r2.x); ++i) {
-		if (valid_corridor_y(r1.y, i)) {
-			tiles[r1.y][i].c = CORRIDOR;
-			tiles[r1.y][i].h = 0;
+		if (valid_corridor_y(g, r1.y, i)) {
+			g.c(r1.y, i) = CORRIDOR;
+			g.set_h(r1.y, i, 0);
 		}
 	}
 
 	for (int i = std::min(r1.y, r2.y); i <= std::max(r1.y, r2.y); ++i) {
-		if (valid_corridor_x(i, r2.x)) {
-			tiles[i][r2.x].c = CORRIDOR;
-			tiles[i][r2.x].h = 0;
+		if (valid_corridor_x(g, i, r2.x)) {
+			g.c(i, r2.x) = CORRIDOR;
+			g.set_h(i, r2.x, 0);
 		}
 	}
 }
 
+std::optional<std::pair<uint16_t, uint16_t>>
+cell_set::take(ranged_random &r)
+{
+	if (cells.empty()) {
+		return std::nullopt;
+	}
+
+	std::size_t const i = r.rrand<std::size_t>(0, cells.size() - 1);
+	uint32_t const c = cells[i];
+
+	cells[i] = cells.back();
+	cells.pop_back();
+
+	return std::make_pair((uint16_t)(c % (uint32_t)width),
+		(uint16_t)(c / (uint32_t)width));
+}
+
+/*
+ * Where stairs can go once the corridors are dug. A stair never makes
+ * another cell valid or invalid but its own. Without corridors, a single
+ * room, any room cell will do.
+ */
 void
-gen_stair(stair &s, bool const up)
+stair_cells(grid &g, cell_set &cells)
+{
+	cells.fill(g, [&g](int const y, int const x) {
+		return valid_stair(g, y, x);
+	});
+
+	if (cells.cells.empty()) {
+		cells.fill(g, [&g](int const y, int const x) {
+			return g.c(y, x) == ROOM;
+		});
+	}
+}
+
+bool
+gen_stair(grid &g, ranged_random &r, cell_set &cells, stair &s,
+	bool const up)
 {
-	uint8_t x, y;
+	std::optional<std::pair<uint16_t, uint16_t>> const coords
+		= cells.take(r);
 
-	do {
-		x = rr.rrand<uint8_t>(1, WIDTH - 2);
-		y = rr.rrand<uint8_t>(1, HEIGHT - 2);
-	} while (!valid_stair(y, x));
+	if (!coords.has_value()) {
+		return false;
+	}
 
-	tiles[y][x].c = up ? STAIR_UP : STAIR_DN;
-	tiles[y][x].h = 0;
+	auto const [x, y] = *coords;
+
+	g.c(y, x) = up ? STAIR_UP : STAIR_DN;
+	g.set_h(y, x, 0);
 
 	s.x = x;
 	s.y = y;
+
+	return true;
 }
 
+/* the bits of word w for cells x0 to x1 */
+static uint64_t
+word_mask(int const w, int const x0, int const x1)
+{
+	int const lo = std::max(x0 - w * 64, 0);
+	int const hi = std::min(x1 - w * 64, 63);
+
+	return (~0ULL >> (63 - hi + lo)) << lo;
+}
+
+/* rock all around, with a margin */
 static bool
-valid_room(room const &r)
+valid_room(grid const &g, room_bits const &occ, room const &r)
 {
-	for (int i = r.x - 1; i <= r.x + r.size_x + 1; ++i) {
-		for (int j = r.y - 1; j <= r.y + r.size_y + 1; ++j) {
-			if (tiles[j][i].c != ROCK) {
-				return false;
-			}
+	int const bottom = r.y + r.size_y + 1;
+
+	if (bottom >= g.height) {
+		return false;
+	}
+
+	for (int j = r.y - 1; j <= bottom; ++j) {
+		if (!occ.clear(j, r.x - 1, r.x + r.size_x + 1)) {
+			return false;
 		}
 	}
 
@@ -100,27 +218,27 @@ valid_room(room const &r)
 }
 
 static int
-valid_corridor_x(int const y, int const x)
+valid_corridor_x(grid &g, int const y, int const x)
 {
-	return tiles[y][x].c == ROCK
-		&& tiles[y][x + 1].c != CORRIDOR
-		&& tiles[y][x - 1].c != CORRIDOR;
+	return g.c(y, x) == ROCK
+		&& g.c(y, x + 1) != CORRIDOR
+		&& g.c(y, x - 1) != CORRIDOR;
 }
 
 static int
-valid_corridor_y(int const y, int const x)
+valid_corridor_y(grid &g, int const y, int const x)
 {
-	return tiles[y][x].c == ROCK
-		&& tiles[y + 1][x].c != CORRIDOR
-		&& tiles[y - 1][x].c != CORRIDOR;
+	return g.c(y, x) == ROCK
+		&& g.c(y + 1, x) != CORRIDOR
+		&& g.c(y - 1, x) != CORRIDOR;
 }
 
 static int
-valid_stair(int const y, int const x)
+valid_stair(grid &g, int const y, int const x)
 {
-	return (tiles[y][x].c == ROCK || tiles[y][x].c == ROOM)
-		&& (tiles[y + 1][x].c == CORRIDOR
-		|| tiles[y - 1][x].c == CORRIDOR
-		|| tiles[y][x + 1].c == CORRIDOR
-		|| tiles[y][x - 1].c == CORRIDOR);
+	return (g.c(y, x) == ROCK || g.c(y, x) == ROOM)
+		&& (g.c(y + 1, x) == CORRIDOR
+		|| g.c(y - 1, x) == CORRIDOR
+		|| g.c(y, x + 1) == CORRIDOR
+		|| g.c(y, x - 1) == CORRIDOR);
 }
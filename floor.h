@@ -18,11 +18,62 @@
 #ifndef ROOM_H
 #define ROOM_H
 
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include "globs.h"
 
-bool	gen_room(room &);
-void	draw_room(room const &);
-void	gen_corridor(room const &, room const &);
-void	gen_stair(stair &, bool const);
+/*
+ * The interior cells of a floor that pass some test, drawn uniformly
+ * without replacement. A draw costs the same however much of the floor
+ * failed the test.
+ */
+struct cell_set {
+	std::vector<uint32_t>	cells;
+	int			width;
+
+	template<typename F> void
+	fill(grid const &g, F const &keep)
+	{
+		cells.clear();
+		width = g.width;
+
+		for (int i = 1; i < g.height - 1; ++i) {
+			for (int j = 1; j < g.width - 1; ++j) {
+				if (keep(i, j)) {
+					cells.push_back((uint32_t)g.at(i, j));
+				}
+			}
+		}
+	}
+
+	/* as (x, y) */
+	std::optional<std::pair<uint16_t, uint16_t>>
+		take(ranged_random &);
+};
+
+/*
+ * What is not rock, one bit per cell, while the rooms of a floor are
+ * placed. A room fits if the bits under it and its margins are clear, one
+ * or two words a row.
+ */
+struct room_bits {
+	std::vector<uint64_t>	bits;
+	std::size_t		stride;
+	int			width;
+
+	void	reset(grid const &);
+	void	set(int const, int const, int const);
+	bool	clear(int const, int const, int const) const;
+};
+
+bool	gen_room(grid &, room_bits const &, ranged_random &, room &);
+void	draw_room(grid &, room const &);
+void	draw_room(grid &, room_bits &, room const &);
+void	gen_corridor(grid &, room const &, room const &);
+void	stair_cells(grid &, cell_set &);
+bool	gen_stair(grid &, ranged_random &, cell_set &, stair &, bool const);
 
 #endif /* ROOM_H */
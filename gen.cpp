@@ -15,46 +15,156 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#define _DEFAULT_SOURCE
-#define _BSD_SOURCE
-#include <endian.h>
-#undef _BSD_SOURCE
-#undef _DEFAULT_SOURCE
-
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <err.h>
-
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "dijk.h"
 #include "floor.h"
+#include "gen.h"
 #include "globs.h"
+#include "pack.h"
+#include "pool.h"
+#include "spawn.h"
+#include "store.h"
+
+/* a mapped save file being decoded */
+struct save_reader {
+	uint8_t const	*p;
+	std::size_t	left;
+};
+
+static void	save_things(std::vector<uint8_t> &);
+static bool	load_things(uint8_t const *const, std::size_t const);
+static bool	load_v0(save_reader &);
+static bool	load_v1(save_reader &);
+static bool	load_hardness(save_reader &, int const, int const);
+static bool	load_valid();
+
+template<typename T> static void	put_be(std::vector<uint8_t> &, T const);
+template<typename T> static bool	get_be(save_reader &, T &);
+
+static void	build(level &, int64_t const);
+static void	build_near();
+static void	pregen_start();
+static void	enter(bool const);
 
-static bool	save_things(FILE *const);
-static bool	load_things(FILE *const);
+static void	clear_tiles(grid &);
+static void	rock_tiles(grid &, ranged_random &);
+static void	arrange_new(level &, ranged_random &);
+static void	arrange_loaded(level &);
+
+static std::size_t	map_scale(grid const &);
+
+static void	init_fresh(level &, ranged_random &);
+static void	place_player(level &, ranged_random &);
+static int	valid_player(grid const &, int const, int const);
+
+static void	populate(level &, ranged_random &);
+static bool	valid_thing(level const &, uint16_t const,
+	uint16_t const);
 
-static void	init_fresh();
-static void	place_player();
-static int	valid_player(int const, int const);
 
 static char const *const DIRECTORY = "/.opal";
 static char const *const FILEPATH = "/dungeon";
-static int constexpr DF_L = 8;
 
 static char const *const MARK = "OPAL-DUNGEON";
 static int constexpr MARK_L = 12;
 
+/* marker, version and file size */
+static std::size_t constexpr HEADER_L = MARK_L + 2 * sizeof(uint32_t);
+
+/*
+ * Version 0 holds an 80x21 map with byte coordinates and 16-bit counts.
+ * Version 1 adds the map size, with 16-bit coordinates and 32-bit counts.
+ * Both are big endian.
+ */
+static uint32_t constexpr SAVE_VERSION = 1;
+
 static int constexpr NEW_ROOM_COUNT = 8;
 static int constexpr ROOM_RETRIES = 150;
 
-static std::vector<stair> stairs_up;
-static std::vector<stair> stairs_dn;
+/* minimum distance from the PC an NPC can be placed */
+static double constexpr CUTOFF = 4.0;
+
+level cur_level;
+grid &tiles = cur_level.tiles;
+
+/*
+ * The floors above and below are generated on the pool while the current
+ * one is played, unless they are already cached. Each floor draws from its
+ * own stream of the game seed, picked by depth, so how far ahead
+ * generation runs never changes what comes out of it.
+ */
+static level near[2];
+static bool wanted[2];
+static int64_t depth;
+static std::optional<pool_token> pending;
+
+/* which descriptions were spent when generation ahead was started */
+static std::vector<uint8_t> spent_npcs;
+static std::vector<uint8_t> spent_objs;
 
-static uint16_t room_count;
-static std::vector<room> rooms;
+static pool_job job_gen = { "level_gen", build_near, {}, {}, {} };
 
-static uint16_t stair_up_count;
-static uint16_t stair_dn_count;
+static unsigned int level_npcs;
+static unsigned int level_objs;
 
-tile tiles[HEIGHT][WIDTH];
+grid::grid()
+{
+	resize(HEIGHT, WIDTH);
+}
+
+void
+grid::resize(int const h, int const w)
+{
+	std::size_t const n = (std::size_t)h * (std::size_t)w;
+
+	height = h;
+	width = w;
+
+	hardness.resize(n);
+	passable.resize(n);
+	glyphs.resize(n);
+	dist.resize(n);
+	dist_t.resize(n);
+	visited.resize(n);
+	npc_at.resize(n);
+	obj_at.resize(n);
+}
+
+/* opal_path, created if missing */
+std::string
+opal_dir()
+{
+	struct stat st;
+	std::string const path = opal_path();
+
+	if (stat(path.c_str(), &st) == -1) {
+		if (errno == ENOENT) {
+			if (mkdir(path.c_str(), 0700) == -1) {
+				err(1, "mkdir %s", path.c_str());
+			}
+		} else {
+			err(1, "stat %s", path.c_str());
+		}
+	}
+
+	return path;
+}
 
 std::string
 opal_path()
@@ -79,347 +189,856 @@ opal_path()
 
 bool
 save_dungeon()
+{
+	std::vector<uint8_t> buf;
+
+	save_things(buf);
+	store_write(opal_dir() + FILEPATH, std::move(buf));
+
+	return true;
+}
+
+bool
+load_dungeon()
 {
 	struct stat st;
-	FILE *f;
+	void *map;
+	int fd;
 	bool ret;
 
-	std::string path = opal_path();
+	std::string const path = opal_path() + FILEPATH;
 
-	if (stat(path.c_str(), &st) == -1) {
-		if (errno == ENOENT) {
-			if (mkdir(path.c_str(), 0700) == -1) {
-				err(1, "save mkdir");
-			}
-		} else {
-			err(1, "save stat");
-		}
+	if ((fd = open(path.c_str(), O_RDONLY)) == -1) {
+		err(1, "load open");
+	}
+
+	if (fstat(fd, &st) == -1) {
+		err(1, "load fstat");
+	}
+
+	/* too short for a header, and mmap(2) refuses empty files */
+	if ((std::size_t)st.st_size < HEADER_L) {
+		(void)close(fd);
+		return false;
 	}
 
-	path += FILEPATH;
+	map = mmap(NULL, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd,
+		0);
+
+	if (map == MAP_FAILED) {
+		err(1, "load mmap");
+	}
 
-	if (!(f = fopen(path.c_str(), "w"))) {
-		err(1, "save fopen");
+	if (close(fd) == -1) {
+		err(1, "load close");
 	}
 
-	ret = save_things(f);
+	ret = load_things(static_cast<uint8_t const *>(map),
+		(std::size_t)st.st_size);
 
-	if (fclose(f) == EOF) {
-		err(1, "save fclose, (save_things=%d)", ret);
+	if (munmap(map, (std::size_t)st.st_size) == -1) {
+		err(1, "load munmap");
 	}
 
 	return ret;
 }
 
-bool
-load_dungeon()
+/* FNV-1a of the saved dungeon, 0 if there is none */
+uint64_t
+dungeon_hash()
 {
-	FILE *f;
-	bool ret;
-	std::string path = opal_path() + FILEPATH;
+	std::vector<uint8_t> buf;
+	uint64_t h = 0xCBF29CE484222325;
+
+	if (!store_read(opal_path() + FILEPATH, buf, SIZE_MAX)) {
+		return 0;
+	}
 
-	if (!(f = fopen(path.c_str(), "r"))) {
-		err(1, "load fopen");
+	for (auto const b : buf) {
+		h = (h ^ b) * 0x100000001B3;
 	}
 
-	ret = load_things(f);
+	return h;
+}
+
+/* set up the first floor, loaded or generated, and start on the next */
+void
+level_first(bool const load, unsigned int const numnpcs,
+	unsigned int const numobjs)
+{
+	level_npcs = numnpcs;
+	level_objs = numobjs;
+
+	if (load) {
+		ranged_random r = rr.stream(STREAM_FLOOR, (uint64_t)depth);
+
+		if (!load_dungeon()) {
+			errx(1, "loading dungeon");
+		}
+
+		clear_tiles(tiles);
+
+		cur_level.x = player.x;
+		cur_level.y = player.y;
 
-	if (fclose(f) == EOF) {
-		err(1, "load fclose, (load_things=%d)", ret);
+		arrange_loaded(cur_level);
+		populate(cur_level, r);
+		dijkstra_fill(tiles, cur_level.y, cur_level.x);
+	} else {
+		build(cur_level, depth);
 	}
 
-	return ret;
+	enter(true);
+	pregen_start();
 }
 
+/*
+ * Take the stairs. The floor left is cached, and so is a pregenerated one
+ * in the other direction, as spawning it already used up its uniques.
+ */
 void
-clear_tiles()
-{
-	for (uint8_t i = 0; i < HEIGHT; ++i) {
-		for (uint8_t j = 0; j < WIDTH; ++j) {
-			tiles[i][j] = {};
-			tiles[i][j].x = j;
-			tiles[i][j].y = i;
-
-			if (i == 0 || j == 0 || i == HEIGHT - 1
-				|| j == WIDTH - 1) {
-				tiles[i][j].h = std::numeric_limits<uint8_t>::max();
-				tiles[i][j].d = std::numeric_limits<int32_t>::max();
-				tiles[i][j].dt = std::numeric_limits<int32_t>::max();
-			} else {
-				tiles[i][j].c = ROCK;
-				tiles[i][j].h = rr.rrand<uint8_t>(1,
-					std::numeric_limits<uint8_t>::max() - 1);
-			}
+level_next(bool const down)
+{
+	int64_t const to = depth + (down ? 1 : -1);
+	int64_t const away = depth + (down ? -1 : 1);
+
+	if (pending.has_value()) {
+		pool_wait(*pending);
+		pending.reset();
+	}
+
+	cur_level.x = player.x;
+	cur_level.y = player.y;
+	cache_put(depth, cur_level);
+
+	if (wanted[!down]) {
+		cache_put(away, near[!down]);
+	}
+
+	depth = to;
+
+	if (wanted[down]) {
+		std::swap(cur_level, near[down]);
+		enter(true);
+	} else if (cache_take(depth, cur_level)) {
+		enter(false);
+	} else {
+		errx(1, "floor %" PRId64 " neither generated nor cached",
+			depth);
+	}
+
+	pregen_start();
+}
+
+/* wait out generation and free the floors */
+void
+level_stop()
+{
+	if (pending.has_value()) {
+		pool_wait(*pending);
+		pending.reset();
+	}
+
+	for (auto *const l : { &cur_level, &near[0], &near[1] }) {
+		for (auto &n : l->npcs) {
+			delete n;
 		}
+
+		for (auto &o : l->objs) {
+			delete o;
+		}
+
+		l->npcs.clear();
+		l->objs.clear();
 	}
 }
 
+/*
+ * Append the dungeon as it stands: the floor in play exactly, the cached
+ * floors, and the pregenerated ones, whose uniques are already spent.
+ *
+ * A save never waits on generation. Floors still being generated are
+ * left out, with the descriptions as they were before it started, and
+ * are generated again on load from their depths.
+ */
 void
-arrange_new()
+level_save(std::vector<uint8_t> &buf, std::vector<store_splice> &spilled)
 {
-	room_count = NEW_ROOM_COUNT;
-	stair_up_count = rr.rrand<uint16_t>(1, (uint16_t)((room_count / 4) + 1));
-	stair_dn_count = rr.rrand<uint16_t>(1, (uint16_t)((room_count / 4) + 1));
+	bool const ahead = pending.has_value() && !pool_done(*pending);
+
+	if (pending.has_value() && !ahead) {
+		pool_wait(*pending);
+		pending.reset();
+	}
 
-	rooms.resize(room_count);
-	stairs_up.resize(stair_up_count);
-	stairs_dn.resize(stair_dn_count);
+	pack_put<int64_t>(buf, depth);
+	pack_put<uint32_t>(buf, level_npcs);
+	pack_put<uint32_t>(buf, level_objs);
 
-	init_fresh();
+	pack_put<uint32_t>(buf, (uint32_t)npcs_parsed.size());
+
+	for (std::size_t i = 0; i < npcs_parsed.size(); ++i) {
+		pack_put<uint8_t>(buf, ahead ? spent_npcs[i]
+			: npcs_parsed[i].done);
+	}
+
+	pack_put<uint32_t>(buf, (uint32_t)objs_parsed.size());
+
+	for (std::size_t i = 0; i < objs_parsed.size(); ++i) {
+		pack_put<uint8_t>(buf, ahead ? spent_objs[i]
+			: objs_parsed[i].done);
+	}
+
+	cur_level.x = player.x;
+	cur_level.y = player.y;
+	floor_encode(cur_level, buf, true);
+
+	cache_save(buf, spilled);
+
+	pack_put<uint8_t>(buf, ahead);
+
+	if (ahead) {
+		return;
+	}
+
+	pack_put<uint8_t>(buf, wanted[0]);
+	pack_put<uint8_t>(buf, wanted[1]);
+
+	for (int i = 0; i < 2; ++i) {
+		if (wanted[i]) {
+			floor_encode(near[i], buf, false);
+		}
+	}
 }
 
+/* the counterpart of level_save, in place of level_first */
 void
-arrange_loaded()
+level_load(std::vector<uint8_t> const &buf, std::size_t &pos)
 {
-	for (auto const &r : rooms) {
-		draw_room(r);
+	depth = pack_get<int64_t>(buf, pos);
+	level_npcs = pack_get<uint32_t>(buf, pos);
+	level_objs = pack_get<uint32_t>(buf, pos);
+
+	/* the descriptions must not have changed since */
+	if (pack_get<uint32_t>(buf, pos) != npcs_parsed.size()) {
+		errx(1, "snapshot npc descriptions differ");
 	}
 
-	for (auto const &s : stairs_up) {
-		tiles[s.y][s.x].c = STAIR_UP;
+	for (auto &n : npcs_parsed) {
+		n.done = pack_get<uint8_t>(buf, pos);
 	}
 
-	for (auto const &s : stairs_dn) {
-		tiles[s.y][s.x].c = STAIR_DN;
+	if (pack_get<uint32_t>(buf, pos) != objs_parsed.size()) {
+		errx(1, "snapshot object descriptions differ");
 	}
 
-	for (int i = 1; i < HEIGHT - 1; ++i) {
-		for (int j = 1; j < WIDTH - 1; ++j) {
-			if (tiles[i][j].h == 0 && tiles[i][j].c == ROCK) {
-				tiles[i][j].c = CORRIDOR;
-			}
+	for (auto &o : objs_parsed) {
+		o.done = pack_get<uint8_t>(buf, pos);
+	}
+
+	spawn_reset();
+
+	floor_decode(buf, pos, cur_level);
+
+	cache_load(buf, pos);
+
+	/* still being generated, they are generated again by pregen_start */
+	bool const ahead = pack_get<uint8_t>(buf, pos);
+	bool const up = !ahead && pack_get<uint8_t>(buf, pos);
+	bool const dn = !ahead && pack_get<uint8_t>(buf, pos);
+
+	/* cached, the pregenerated floors come back the same way */
+	for (auto const &[want, d] : { std::make_pair(up, depth - 1),
+		std::make_pair(dn, depth + 1) }) {
+		if (!want) {
+			continue;
 		}
+
+		level l;
+
+		floor_decode(buf, pos, l);
+		cache_put(d, l);
 	}
+
+	enter(false);
+	pregen_start();
 }
 
 void
-arrange_renew()
+level_stats(FILE *const f)
 {
-	clear_tiles();
+	pool_print(f, job_gen);
+	cache_stats(f);
+	spawn_stats(f);
+}
 
-	rooms.clear();
-	stairs_up.clear();
-	stairs_dn.clear();
+static void
+build(level &l, int64_t const d)
+{
+	ranged_random r = rr.stream(STREAM_FLOOR, (uint64_t)d);
 
-	arrange_new();
+	clear_tiles(l.tiles);
+	rock_tiles(l.tiles, r);
+	arrange_new(l, r);
+	populate(l, r);
+	dijkstra_fill(l.tiles, l.y, l.x);
 }
 
-static bool
-save_things(FILE *const f)
+/* up first, so uniques land the same way every run */
+static void
+build_near()
 {
-	uint32_t const ver = htobe32(0);
-	uint32_t const filesize = htobe32((uint32_t)(1708 + (room_count * 4)
-		+ (stair_up_count * 2) + (stair_dn_count * 2)));
+	if (wanted[0]) {
+		build(near[0], depth - 1);
+	}
 
-	/* type marker */
-	if (fwrite(MARK, MARK_L, 1, f) != 1) {
-		return false;
+	if (wanted[1]) {
+		build(near[1], depth + 1);
 	}
+}
 
-	/* version */
-	if (fwrite(&ver, sizeof(uint32_t), 1, f) != 1) {
-		return false;
+static void
+pregen_start()
+{
+	wanted[0] = !cache_has(depth - 1);
+	wanted[1] = !cache_has(depth + 1);
+
+	if (!wanted[0] && !wanted[1]) {
+		return;
 	}
 
-	/* size */
-	if (fwrite(&filesize, sizeof(uint32_t), 1, f) != 1) {
-		return false;
+	for (auto &l : near) {
+		l.tiles.resize(tiles.height, tiles.width);
 	}
 
-	/* player coords */
-	if (fwrite(&player.x, sizeof(uint8_t), 1, f) != 1) {
-		return false;
+	spent_npcs.resize(npcs_parsed.size());
+	spent_objs.resize(objs_parsed.size());
+
+	for (std::size_t i = 0; i < npcs_parsed.size(); ++i) {
+		spent_npcs[i] = npcs_parsed[i].done;
 	}
-	if (fwrite(&player.y, sizeof(uint8_t), 1, f) != 1) {
-		return false;
+
+	for (std::size_t i = 0; i < objs_parsed.size(); ++i) {
+		spent_objs[i] = objs_parsed[i].done;
 	}
 
-	/* hardness */
-	for (std::size_t i = 0; i < HEIGHT; ++i) {
-		for (std::size_t j = 0; j < WIDTH; ++j) {
-			if (fwrite(&tiles[i][j].h, sizeof(uint8_t), 1, f) != 1) {
-				return false;
+	pending.emplace(1);
+	pool_submit(job_gen, *pending);
+}
+
+/* fresh floors come with their distance maps, cached ones rebuild them */
+static void
+enter(bool const fresh)
+{
+	player.x = cur_level.x;
+	player.y = cur_level.y;
+
+	if (fresh) {
+		dijkstra_adopt();
+	} else {
+		dijkstra_invalidate();
+	}
+}
+
+/* everything but the hardness, which is drawn or loaded */
+static void
+clear_tiles(grid &g)
+{
+	/* each array is written once, these are big on big maps */
+	std::fill(g.glyphs.begin(), g.glyphs.end(), ROCK);
+	std::fill(g.dist.begin(), g.dist.end(),
+		std::numeric_limits<int32_t>::max());
+	std::fill(g.dist_t.begin(), g.dist_t.end(),
+		std::numeric_limits<int32_t>::max());
+	std::fill(g.visited.begin(), g.visited.end(), 0);
+	std::fill(g.npc_at.begin(), g.npc_at.end(), nullptr);
+	std::fill(g.obj_at.begin(), g.obj_at.end(), nullptr);
+
+	/* the first and last rows whole, the others at both ends */
+	for (int i = 0; i < g.height; ++i) {
+		for (int j = 0; j < g.width; j += (i == 0 || i == g.height - 1)
+			? 1 : g.width - 1) {
+			g.c(i, j) = 0;
+		}
+	}
+}
+
+/* rock of random hardness, inside an unbreakable border */
+static void
+rock_tiles(grid &g, ranged_random &r)
+{
+	r.fill(g.hardness.data(), g.hardness.size(), 1, UINT8_MAX - 1);
+	std::fill(g.passable.begin(), g.passable.end(), 0);
+
+	for (int i = 0; i < g.height; ++i) {
+		for (int j = 0; j < g.width; j += (i == 0 || i == g.height - 1)
+			? 1 : g.width - 1) {
+			g.set_h(i, j, UINT8_MAX);
+		}
+	}
+}
+
+static void
+arrange_new(level &l, ranged_random &r)
+{
+	uint16_t const room_count
+		= (uint16_t)(NEW_ROOM_COUNT * map_scale(l.tiles));
+
+	l.rooms.resize(room_count);
+	l.stairs_up.resize(r.rrand<uint16_t>(1,
+		(uint16_t)((room_count / 4) + 1)));
+	l.stairs_dn.resize(r.rrand<uint16_t>(1,
+		(uint16_t)((room_count / 4) + 1)));
+
+	init_fresh(l, r);
+}
+
+static void
+arrange_loaded(level &l)
+{
+	for (auto const &r : l.rooms) {
+		draw_room(l.tiles, r);
+	}
+
+	for (auto const &s : l.stairs_up) {
+		l.tiles.c(s.y, s.x) = STAIR_UP;
+	}
+
+	for (auto const &s : l.stairs_dn) {
+		l.tiles.c(s.y, s.x) = STAIR_DN;
+	}
+
+	for (int i = 1; i < l.tiles.height - 1; ++i) {
+		for (int j = 1; j < l.tiles.width - 1; ++j) {
+			if (l.tiles.open(i, j) && l.tiles.c(i, j) == ROCK) {
+				l.tiles.c(i, j) = CORRIDOR;
 			}
 		}
 	}
+}
 
-	/* room num */
-	room_count = htobe16(room_count);
-	if (fwrite(&room_count, sizeof(uint16_t), 1, f) != 1) {
-		return false;
+static void
+save_things(std::vector<uint8_t> &buf)
+{
+	std::size_t const tiles_l = tiles.hardness.size();
+	std::size_t const size = HEADER_L + 4 * sizeof(uint16_t) + tiles_l
+		+ 3 * sizeof(uint32_t) + cur_level.rooms.size() * 8
+		+ (cur_level.stairs_up.size() + cur_level.stairs_dn.size()) * 4;
+
+	buf.reserve(size);
+
+	buf.insert(buf.end(), MARK, MARK + MARK_L);
+	put_be<uint32_t>(buf, SAVE_VERSION);
+	put_be<uint32_t>(buf, (uint32_t)size);
+
+	put_be<uint16_t>(buf, (uint16_t)tiles.width);
+	put_be<uint16_t>(buf, (uint16_t)tiles.height);
+	put_be<uint16_t>(buf, player.x);
+	put_be<uint16_t>(buf, player.y);
+
+	buf.insert(buf.end(), tiles.hardness.begin(), tiles.hardness.end());
+
+	put_be<uint32_t>(buf, (uint32_t)cur_level.rooms.size());
+
+	for (auto const &r : cur_level.rooms) {
+		put_be<uint16_t>(buf, r.x);
+		put_be<uint16_t>(buf, r.y);
+		put_be<uint16_t>(buf, r.size_x);
+		put_be<uint16_t>(buf, r.size_y);
 	}
-	room_count = be16toh(room_count);
 
-	/* room data */
-	for (auto const &r : rooms) {
-		if (fwrite(&r, sizeof(room), 1, f) != 1) {
-			return false;
+	for (auto const *const stairs
+		: { &cur_level.stairs_up, &cur_level.stairs_dn }) {
+		put_be<uint32_t>(buf, (uint32_t)stairs->size());
+
+		for (auto const &s : *stairs) {
+			put_be<uint16_t>(buf, s.x);
+			put_be<uint16_t>(buf, s.y);
 		}
 	}
+}
+
+/* check the header, then decode the version found */
+static bool
+load_things(uint8_t const *const buf, std::size_t const len)
+{
+	save_reader r = { buf + MARK_L, len - MARK_L };
+	uint32_t ver;
+	uint32_t filesize;
+
+	if (std::memcmp(buf, MARK, MARK_L) != 0) {
+		return false;
+	}
 
-	/* stairs_up num */
-	stair_up_count = htobe16(stair_up_count);
-	if (fwrite(&stair_up_count, sizeof(uint16_t), 1, f) != 1) {
+	if (!get_be(r, ver) || !get_be(r, filesize) || filesize != len) {
 		return false;
 	}
-	stair_up_count = be16toh(stair_up_count);
 
-	/* stars_up coords */
-	for (auto const &s : stairs_up) {
-		if (fwrite(&s, sizeof(stair), 1, f) != 1) {
+	switch (ver) {
+	case 0:
+		if (!load_v0(r)) {
 			return false;
 		}
+		break;
+	case 1:
+		if (!load_v1(r)) {
+			return false;
+		}
+		break;
+	default:
+		return false;
 	}
 
-	/* stairs_dn num */
-	stair_dn_count = htobe16(stair_dn_count);
-	if (fwrite(&stair_dn_count, sizeof(uint16_t), 1, f) != 1) {
+	return r.left == 0 && load_valid();
+}
+
+static bool
+load_v0(save_reader &r)
+{
+	uint8_t x, y;
+	uint16_t count;
+
+	if (!get_be(r, x) || !get_be(r, y)) {
+		return false;
+	}
+
+	player.x = x;
+	player.y = y;
+
+	if (!load_hardness(r, HEIGHT, WIDTH)) {
+		return false;
+	}
+
+	if (!get_be(r, count) || r.left < count * 4U) {
 		return false;
 	}
-	stair_dn_count = be16toh(stair_dn_count);
 
-	/* stairs_dn coords */
-	for (auto const &s : stairs_dn) {
-		if (fwrite(&s, sizeof(stair), 1, f) != 1) {
+	cur_level.rooms.resize(count);
+
+	for (auto &rm : cur_level.rooms) {
+		uint8_t b[4];
+
+		for (auto &v : b) {
+			(void)get_be(r, v);
+		}
+
+		rm = { b[0], b[1], b[2], b[3] };
+	}
+
+	for (auto *const stairs
+		: { &cur_level.stairs_up, &cur_level.stairs_dn }) {
+		if (!get_be(r, count) || r.left < count * 2U) {
 			return false;
 		}
+
+		stairs->resize(count);
+
+		for (auto &s : *stairs) {
+			(void)get_be(r, x);
+			(void)get_be(r, y);
+			s = { x, y };
+		}
 	}
 
 	return true;
 }
 
 static bool
-load_things(FILE *const f)
+load_v1(save_reader &r)
 {
-	/* skip type marker, version, and size */
-	if (fseek(f, MARK_L + 2 * sizeof(uint32_t), SEEK_SET) == -1) {
-		return false;
-	}
+	uint16_t w, h;
+	uint32_t count;
 
-	/* player coords */
-	if (fread(&player.x, sizeof(uint8_t), 1, f) != 1) {
+	if (!get_be(r, w) || !get_be(r, h)
+		|| !get_be(r, player.x) || !get_be(r, player.y)) {
 		return false;
 	}
-	if (fread(&player.y, sizeof(uint8_t), 1, f) != 1) {
+
+	if (w < WIDTH || h < HEIGHT || w > DIM_MAX || h > DIM_MAX) {
 		return false;
 	}
 
-	/* hardness */
-	for (std::size_t i = 0; i < HEIGHT; ++i) {
-		for (std::size_t j = 0; j < WIDTH; ++j) {
-			if (fread(&tiles[i][j].h, sizeof(uint8_t), 1, f) != 1) {
-				return false;
-			}
-		}
+	if (!load_hardness(r, h, w)) {
+		return false;
 	}
 
-	/* room num */
-	if (fread(&room_count, sizeof(uint16_t), 1, f) != 1) {
+	if (!get_be(r, count) || r.left / 8 < count) {
 		return false;
 	}
-	room_count = be16toh(room_count);
 
-	rooms.resize(room_count);
+	cur_level.rooms.resize(count);
+
+	for (auto &rm : cur_level.rooms) {
+		(void)get_be(r, rm.x);
+		(void)get_be(r, rm.y);
+		(void)get_be(r, rm.size_x);
+		(void)get_be(r, rm.size_y);
+	}
 
-	/* room data */
-	for (auto &r : rooms) {
-		if (fread(&r, sizeof(room), 1, f) != 1) {
+	for (auto *const stairs
+		: { &cur_level.stairs_up, &cur_level.stairs_dn }) {
+		if (!get_be(r, count) || r.left / 4 < count) {
 			return false;
 		}
+
+		stairs->resize(count);
+
+		for (auto &s : *stairs) {
+			(void)get_be(r, s.x);
+			(void)get_be(r, s.y);
+		}
 	}
 
-	/* stair_up num */
-	if (fread(&stair_up_count, sizeof(uint16_t), 1, f) != 1) {
+	return true;
+}
+
+/* size the grid to the saved map and copy its hardness straight in */
+static bool
+load_hardness(save_reader &r, int const h, int const w)
+{
+	std::size_t const n = (std::size_t)h * (std::size_t)w;
+
+	if (r.left < n) {
 		return false;
 	}
-	stair_up_count = be16toh(stair_up_count);
 
-	stairs_up.resize(stair_up_count);
+	tiles.resize(h, w);
+	std::memcpy(tiles.hardness.data(), r.p, n);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		tiles.passable[i] = tiles.hardness[i] == 0;
+	}
+
+	r.p += n;
+	r.left -= n;
+
+	return true;
+}
+
+/* what the save says must fit on its map before anything is drawn */
+static bool
+load_valid()
+{
+	/* last open row and column */
+	int const w = tiles.width - 2;
+	int const h = tiles.height - 2;
+
+	if (player.x < 1 || player.y < 1 || player.x > w || player.y > h) {
+		return false;
+	}
 
-	/* stair_up coords */
-	for (auto &s : stairs_up) {
-		if (fread(&s, sizeof(stair), 1, f) != 1) {
+	for (auto const &r : cur_level.rooms) {
+		if (r.x < 1 || r.y < 1 || r.x + r.size_x - 1 > w
+			|| r.y + r.size_y - 1 > h) {
 			return false;
 		}
 	}
 
-	/* stair_dn num */
-	if (fread(&stair_dn_count, sizeof(uint16_t), 1, f) != 1) {
+	for (auto const *const stairs
+		: { &cur_level.stairs_up, &cur_level.stairs_dn }) {
+		for (auto const &s : *stairs) {
+			if (s.x < 1 || s.y < 1 || s.x > w || s.y > h) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+template<typename T> static void
+put_be(std::vector<uint8_t> &buf, T const val)
+{
+	for (std::size_t i = sizeof(T); i > 0; --i) {
+		buf.push_back((uint8_t)(val >> ((i - 1) * 8)));
+	}
+}
+
+template<typename T> static bool
+get_be(save_reader &r, T &val)
+{
+	if (r.left < sizeof(T)) {
 		return false;
 	}
-	stair_dn_count = be16toh(stair_dn_count);
 
-	stairs_dn.resize(stair_dn_count);
+	val = 0;
 
-	/* stair_dn_coords */
-	for (auto &s : stairs_dn) {
-		if (fread(&s, sizeof(stair), 1, f) != 1) {
-			return false;
-		}
+	for (std::size_t i = 0; i < sizeof(T); ++i) {
+		val = (T)((val << 8) | r.p[i]);
 	}
 
+	r.p += sizeof(T);
+	r.left -= sizeof(T);
+
 	return true;
 }
 
+/* how many default-sized maps fit in this one */
+static std::size_t
+map_scale(grid const &g)
+{
+	std::size_t const area = (std::size_t)(g.width * g.height);
+
+	return std::max<std::size_t>(1, area / (WIDTH * HEIGHT));
+}
+
 static void
-init_fresh()
+init_fresh(level &l, ranged_random &r)
 {
 	std::size_t i = 0;
 	std::size_t retries = 0;
+	std::size_t const retries_max = ROOM_RETRIES * map_scale(l.tiles);
+
+	/* scratch per thread, as floors are also generated on the pool */
+	thread_local room_bits occ;
+	occ.reset(l.tiles);
 
-	for (auto it = rooms.begin(); it != rooms.end()
-		&& retries < ROOM_RETRIES; ++it) {
-		if (!gen_room(*it)) {
+	for (auto it = l.rooms.begin(); it != l.rooms.end()
+		&& retries < retries_max; ++it) {
+		if (!gen_room(l.tiles, occ, r, *it)) {
 			retries++;
 			it--;
 		} else {
 			i++;
-			draw_room(*it);
+			draw_room(l.tiles, occ, *it);
 		}
 	}
 
-	if (i < room_count) {
+	if (i < l.rooms.size()) {
 		if (i == 0) {
 			errx(1, "unable to place any rooms");
 		}
 
-		room_count = (uint16_t)i;
-		rooms.resize(room_count);
+		l.rooms.resize(i);
 	}
 
-	for (i = 0; i < room_count - 1U; ++i) {
-		gen_corridor(rooms[i], rooms[i+1]);
+	for (i = 0; i < l.rooms.size() - 1U; ++i) {
+		gen_corridor(l.tiles, l.rooms[i], l.rooms[i+1]);
 	}
 
-	for (auto &s : stairs_up) {
-		gen_stair(s, true);
-	}
+	cell_set cells;
+	stair_cells(l.tiles, cells);
+
+	/* as many stairs as fit */
+	for (auto *const stairs : { &l.stairs_up, &l.stairs_dn }) {
+		bool const up = stairs == &l.stairs_up;
 
-	for (auto &s : stairs_dn) {
-		gen_stair(s, true);
+		for (i = 0; i < stairs->size(); ++i) {
+			if (!gen_stair(l.tiles, r, cells, (*stairs)[i], up)) {
+				stairs->resize(i);
+				break;
+			}
+		}
 	}
 
-	place_player();
+	place_player(l, r);
 }
 
 static void
-place_player()
+place_player(level &l, ranged_random &r)
 {
-	uint8_t x, y;
+	cell_set cells;
 
-	do {
-		x = rr.rrand<uint8_t>(1, WIDTH - 2);
-		y = rr.rrand<uint8_t>(1, HEIGHT - 2);
-	} while (!valid_player(y, x));
+	cells.fill(l.tiles, [&l](int const y, int const x) {
+		return valid_player(l.tiles, y, x);
+	});
 
-	player.x = x;
-	player.y = y;
+	std::optional<std::pair<uint16_t, uint16_t>> const coords
+		= cells.take(r);
+
+	if (!coords.has_value()) {
+		errx(1, "unable to place the PC");
+	}
+
+	l.x = coords->first;
+	l.y = coords->second;
 }
 
 static int
-valid_player(int const y, int const x)
+valid_player(grid const &g, int const y, int const x)
+{
+	return g.open(y, x)
+		&& g.open(y + 1, x) && g.open(y - 1, x)
+		&& g.open(y, x + 1) && g.open(y, x - 1);
+}
+
+/* spawn the NPCs and objects of a floor */
+static void
+populate(level &l, ranged_random &r)
+{
+	try {
+		l.npcs.reserve(level_npcs);
+		l.objs.reserve(level_objs);
+	} catch (std::bad_alloc const &) {
+		err(1, "reserve npcs and objs");
+	}
+
+	/* placed first, so that no unique is spent on a full floor */
+	cell_set npc_cells;
+	npc_cells.fill(l.tiles, [&l](int const y, int const x) {
+		return valid_thing(l, (uint16_t)y, (uint16_t)x);
+	});
+
+	/* objects may share a cell with an NPC, not with each other */
+	cell_set obj_cells = npc_cells;
+
+	for (unsigned int k = 0; k < level_npcs; ++k) {
+		std::optional<std::pair<uint16_t, uint16_t>> const coords
+			= npc_cells.take(r);
+
+		if (!coords.has_value()) {
+			break;
+		}
+
+		std::optional<std::size_t> const i = spawn_npc(r);
+
+		if (!i.has_value()) {
+			break;
+		}
+
+		npc *const n = new npc(npcs_parsed[*i]);
+
+		n->x = coords->first;
+		n->y = coords->second;
+		n->turn = 1;
+
+		l.tiles.n(n->y, n->x) = n;
+		l.npcs.push_back(n);
+	}
+
+	for (unsigned int k = 0; k < level_objs; ++k) {
+		std::optional<std::pair<uint16_t, uint16_t>> const coords
+			= obj_cells.take(r);
+
+		if (!coords.has_value()) {
+			break;
+		}
+
+		std::optional<std::size_t> const i = spawn_obj(r);
+
+		if (!i.has_value()) {
+			break;
+		}
+
+		obj *const o = new obj(objs_parsed[*i]);
+
+		o->x = coords->first;
+		o->y = coords->second;
+
+		l.tiles.o(o->y, o->x) = o;
+		l.objs.push_back(o);
+	}
+}
+
+static bool
+valid_thing(level const &l, uint16_t const y, uint16_t const x)
 {
-	return tiles[y][x].h == 0
-		&& tiles[y + 1][x].h == 0 && tiles[y - 1][x].h == 0
-		&& tiles[y][x + 1].h == 0 && tiles[y][x - 1].h == 0;
+	if (!l.tiles.open(y, x)) {
+		return false;
+	}
+
+	int const dx = x - l.x;
+	int const dy = y - l.y;
+
+	return std::sqrt(dx * dx + dy * dy) > CUTOFF;
 }
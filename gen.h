@@ -18,18 +18,30 @@
 #ifndef GEN_H
 #define GEN_H
 
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <string>
+#include <vector>
+
+#include "store.h"
 
 std::string	opal_path();
+std::string	opal_dir();
 
 /* io */
 bool	save_dungeon();
 bool	load_dungeon();
+uint64_t	dungeon_hash();
+
+/* floors */
+void	level_first(bool const, unsigned int const, unsigned int const);
+void	level_next(bool const);
+void	level_stop();
+void	level_stats(FILE *const);
 
-/* gen */
-void	clear_tiles();
-void	arrange_new();
-void	arrange_loaded();
-void	arrange_renew();
+/* snapshots */
+void	level_save(std::vector<uint8_t> &, std::vector<store_splice> &);
+void	level_load(std::vector<uint8_t> const &, std::size_t &);
 
 #endif /* GEN_H */
@@ -20,13 +20,18 @@
 
 #include <cstdint>
 #include <ncurses.h>
+#include <string_view>
 #include <vector>
 
 #include "rand.h"
 
+/* screen size, and the default map size */
 int constexpr WIDTH = 80;
 int constexpr HEIGHT = 21;
 
+/* largest map dimension, see -W and -H */
+int constexpr DIM_MAX = 2048;
+
 int constexpr TUNNEL_STRENGTH = 85;
 
 char constexpr PLAYER = '@';
@@ -66,9 +71,15 @@ struct dice {
 	uint64_t	sides;
 };
 
+/*
+ * What a description file says about one kind of NPC or object. It is
+ * shared by every instance spawned from it, which keeps only the state of
+ * its own that can change during play.
+ */
 struct dungeon_thing {
-	std::string	desc;
-	std::string	name;
+	/* views of text kept for the whole game, see text_arena */
+	std::string_view	desc;
+	std::string_view	name;
 	uint64_t	speed;
 	dice		dam;
 
@@ -77,44 +88,36 @@ struct dungeon_thing {
 
 	unsigned int	symb;
 	uint8_t		rrty;
-	uint8_t		x;
-	uint8_t		y;
-	bool		done;
 
-	dungeon_thing() = default;
+	/* a unique NPC or an artifact was spawned */
+	bool		done;
+};
 
-	dungeon_thing(dungeon_thing const &t)
-	{
-		color = t.color;
-		desc = t.desc;
-		name = t.name;
-		dam = t.dam;
-		symb = t.symb;
-		rrty = t.rrty;
-		speed = t.speed;
-		x = 0;
-		y = 0;
-		done = false;
-	}
+struct npc_proto : dungeon_thing {
+	uint64_t	hp;
+	uint16_t	type;
 };
 
-struct npc : dungeon_thing {
+struct npc {
+	npc_proto const	*proto;
 	uint64_t	hp;
+	uint64_t	speed;
 	uint64_t	p_count;
 	uint64_t	turn;
-	uint16_t	type;
+	uint16_t	x;
+	uint16_t	y;
 	bool		dead;
 
+	/* the slot of the turn wheel the npc waits in, see wheel.h */
+	npc		*next;
+	npc		*prev;
+
 	npc() = default;
 
-	npc(npc const &n) : dungeon_thing(n)
-	{
-		type = n.type;
-		hp = n.hp;
-		turn = 0;
-		p_count = 0;
-		dead = n.dead;
-	}
+	explicit npc(npc_proto const &p) : proto(&p), hp(p.hp),
+		speed(p.speed), p_count(0), turn(0), x(0), y(0), dead(false),
+		next(NULL), prev(NULL)
+	{}
 };
 
 enum type {
@@ -139,7 +142,7 @@ enum type {
 	weapon
 };
 
-struct obj : dungeon_thing {
+struct obj_proto : dungeon_thing {
 	uint64_t	def;
 	uint64_t	dodge;
 	uint64_t	hit;
@@ -148,64 +151,161 @@ struct obj : dungeon_thing {
 	uint64_t	attr;
 	type		obj_type;
 	bool		art;
+};
+
+struct obj {
+	obj_proto const	*proto;
+	uint16_t	x;
+	uint16_t	y;
 
 	obj() = default;
 
-	obj(obj const &o) : dungeon_thing(o)
-	{
-		def = o.def;
-		dodge = o.dodge;
-		hit = o.hit;
-		val = o.val;
-		weight = o.weight;
-		attr = o.attr;
-		obj_type = o.obj_type;
-		art = o.art;
-	}
+	explicit obj(obj_proto const &p) : proto(&p), x(0), y(0)
+	{}
 };
 
 struct room {
-	uint8_t	x;
-	uint8_t	y;
-	uint8_t	size_x;
-	uint8_t	size_y;
+	uint16_t	x;
+	uint16_t	y;
+	uint16_t	size_x;
+	uint16_t	size_y;
 };
 
 struct stair {
-	uint8_t	x;
-	uint8_t	y;
+	uint16_t	x;
+	uint16_t	y;
 };
 
-struct tile {
-	/* turn engine */
-	npc	*n;
-	obj	*o;
-
-	uint8_t	h; /* hardness */
-	chtype	c; /* character */
+/*
+ * Floor storage. Each per-tile field lives in its own dense array so that
+ * sweeps over a single field, such as pathfinding over hardness and
+ * distance or line of sight over hardness, stream through contiguous
+ * memory instead of striding over fields they never read.
+ */
+struct grid {
+	int	width;
+	int	height;
 
-	uint8_t	x;
-	uint8_t	y;
+	std::vector<uint8_t>	hardness;
+	std::vector<uint8_t>	passable; /* hardness == 0 */
+	std::vector<chtype>	glyphs;
 
 	/* dijkstra distance cost */
-	int32_t	d;
-	int32_t	dt;
-
-	/* dijkstra valid node */
-	bool	vd;
-	bool	vdt;
+	std::vector<int32_t>	dist;
+	std::vector<int32_t>	dist_t;
 
 	/* visited by PC */
-	bool	v;
+	std::vector<uint8_t>	visited;
+
+	/* turn engine occupancy */
+	std::vector<npc *>	npc_at;
+	std::vector<obj *>	obj_at;
+
+	grid();
+
+	void	resize(int const, int const);
+
+	std::size_t
+	at(int const y, int const x) const
+	{
+		return (std::size_t)y * (std::size_t)width + (std::size_t)x;
+	}
+
+	uint8_t
+	h(int const y, int const x) const
+	{
+		return hardness[at(y, x)];
+	}
+
+	void
+	set_h(int const y, int const x, uint8_t const val)
+	{
+		hardness[at(y, x)] = val;
+		passable[at(y, x)] = val == 0;
+	}
+
+	bool
+	open(int const y, int const x) const
+	{
+		return passable[at(y, x)];
+	}
+
+	chtype &
+	c(int const y, int const x)
+	{
+		return glyphs[at(y, x)];
+	}
+
+	int32_t &
+	d(int const y, int const x)
+	{
+		return dist[at(y, x)];
+	}
+
+	int32_t &
+	dt(int const y, int const x)
+	{
+		return dist_t[at(y, x)];
+	}
+
+	uint8_t &
+	v(int const y, int const x)
+	{
+		return visited[at(y, x)];
+	}
+
+	npc *&
+	n(int const y, int const x)
+	{
+		return npc_at[at(y, x)];
+	}
+
+	obj *&
+	o(int const y, int const x)
+	{
+		return obj_at[at(y, x)];
+	}
+};
+
+/*
+ * Everything generated for one floor. Floors are built off to the side and
+ * swapped in whole when the PC takes the stairs.
+ */
+struct level {
+	grid			tiles;
+	std::vector<room>	rooms;
+	std::vector<stair>	stairs_up;
+	std::vector<stair>	stairs_dn;
+	std::vector<npc *>	npcs;
+	std::vector<obj *>	objs;
+
+	/* where the PC arrives, or where it left when cached */
+	uint16_t		x;
+	uint16_t		y;
 };
 
 extern ranged_random rr;
 
 extern npc player;
 
-extern tile tiles[HEIGHT][WIDTH];
-
-extern std::vector<npc> npcs_parsed;
-extern std::vector<obj> objs_parsed;
+/* the floor in play, and its grid */
+extern level cur_level;
+extern grid &tiles;
+
+extern std::vector<npc_proto> npcs_parsed;
+extern std::vector<obj_proto> objs_parsed;
+
+/* index in npcs_parsed or objs_parsed of what an instance was spawned from */
+inline std::size_t
+proto_index(npc const &n)
+{
+	return (std::size_t)(n.proto - npcs_parsed.data());
+}
+
+inline std::size_t
+proto_index(obj const &o)
+{
+	return (std::size_t)(o.proto - objs_parsed.data());
+}
 
 #endif /* GLOBS_H */
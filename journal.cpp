@@ -0,0 +1,333 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "gen.h"
+#include "journal.h"
+#include "pack.h"
+#include "snap.h"
+#include "store.h"
+
+static bool	read_journal();
+static void	create();
+static void	open_append(std::size_t const);
+static void	flush();
+
+/*
+ * Every key the PC's turns consume is appended to a journal, after a header
+ * with what the game started from. The game is deterministic in its seed,
+ * options and keys, so a game that crashed is recovered by playing the
+ * keys back, from its start or from its last snapshot, which records how
+ * many keys it had consumed.
+ *
+ * Keys are buffered and written in batches, so a crash loses at most the
+ * last few.
+ */
+static char const *const FILEPATH = "/journal";
+
+static char const *const MARK = "OPAL-JOURNAL";
+static std::size_t constexpr MARK_L = 12;
+
+static uint32_t constexpr JOURNAL_VERSION = 1;
+
+/* marker, version and the game */
+static std::size_t constexpr HEADER_L = MARK_L + sizeof(uint32_t)
+	+ 4 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t)
+	+ sizeof(uint8_t);
+
+static std::size_t constexpr BATCH = 16;
+
+/* appended once the game is over, with nothing left to recover */
+static int32_t constexpr END = INT32_MIN;
+
+static int fd = -1;
+static std::vector<uint8_t> pending;
+
+static journal_game game;
+static bool found;
+static bool ended;
+
+/* keys of the journal on disk, the first being key game.base */
+static std::vector<int32_t> keys;
+
+/* index of the next key, and of the first one not played back */
+static uint64_t next;
+static uint64_t replay_end;
+
+/* a new game, replacing the last journal */
+void
+journal_start(journal_game &g)
+{
+	std::random_device rd;
+
+	g.nonce = (uint64_t)rd() << 32 | rd();
+	g.base = 0;
+
+	game = g;
+	keys.clear();
+	next = 0;
+	replay_end = 0;
+
+	create();
+}
+
+/*
+ * Pick what -r resumes. A journal of a new or loaded game left unfinished
+ * without a snapshot of its own is played back from the start, into g.
+ * Otherwise the snapshot is loaded, g taking only its seed, and
+ * journal_load plays back whatever keys the journal has past it.
+ *
+ * An unfinished journal that cannot be played back is left alone rather
+ * than lost to another game's snapshot; a new game replaces it.
+ */
+enum journal_origin
+journal_recover(journal_game &g)
+{
+	uint64_t seed, nonce;
+	bool const snap = snap_peek(seed, nonce);
+
+	found = read_journal();
+
+	if (found && !ended && (!snap || nonce != game.nonce)) {
+		if (game.origin == JOURNAL_SNAPSHOT) {
+			errx(1, "the snapshot the last game went on from "
+				"is gone, so it cannot be resumed");
+		}
+
+		if (game.origin == JOURNAL_LOADED
+			&& game.dungeon != dungeon_hash()) {
+			errx(1, "the dungeon the last game loaded has changed, "
+				"so it cannot be resumed");
+		}
+
+		g = game;
+		next = 0;
+		replay_end = keys.size();
+		open_append(keys.size());
+
+		return game.origin;
+	}
+
+	if (!snap) {
+		errx(1, "no game to resume");
+	}
+
+	g.seed = seed;
+
+	return JOURNAL_SNAPSHOT;
+}
+
+/* a game over has nothing to recover */
+void
+journal_stop(bool const over)
+{
+	if (over) {
+		pack_put<int32_t>(pending, END);
+	}
+
+	flush();
+
+	if (close(fd) == -1) {
+		err(1, "journal close");
+	}
+
+	fd = -1;
+}
+
+/* the next key, played back or read and appended */
+int
+journal_key(WINDOW *const win)
+{
+	if (next < replay_end) {
+		return keys[next++ - game.base];
+	}
+
+	int const ch = wgetch(win);
+
+	pack_put<int32_t>(pending, ch);
+	next++;
+
+	if (pending.size() >= BATCH * sizeof(int32_t)) {
+		flush();
+	}
+
+	return ch;
+}
+
+bool
+journal_replaying()
+{
+	return next < replay_end;
+}
+
+void
+journal_save(std::vector<uint8_t> &buf)
+{
+	pack_put<uint64_t>(buf, game.nonce);
+	pack_put<uint64_t>(buf, next);
+}
+
+/* go on from a snapshot, after journal_recover */
+void
+journal_load(std::vector<uint8_t> const &buf, std::size_t &pos)
+{
+	uint64_t const nonce = pack_get<uint64_t>(buf, pos);
+
+	next = pack_get<uint64_t>(buf, pos);
+
+	if (found && !ended && game.nonce == nonce && game.base <= next
+		&& next <= game.base + keys.size()) {
+		replay_end = game.base + keys.size();
+		open_append(keys.size());
+		return;
+	}
+
+	/* the keys since are lost, or the game was given up */
+	game = {};
+	game.nonce = nonce;
+	game.base = next;
+	game.origin = JOURNAL_SNAPSHOT;
+
+	keys.clear();
+	replay_end = next;
+
+	create();
+}
+
+static bool
+read_journal()
+{
+	std::vector<uint8_t> buf;
+	std::size_t pos = MARK_L;
+
+	if (!store_read(opal_path() + FILEPATH, buf, SIZE_MAX)
+		|| buf.size() < HEADER_L
+		|| std::memcmp(buf.data(), MARK, MARK_L) != 0
+		|| pack_get<uint32_t>(buf, pos) != JOURNAL_VERSION) {
+		return false;
+	}
+
+	game.nonce = pack_get<uint64_t>(buf, pos);
+	game.base = pack_get<uint64_t>(buf, pos);
+	game.seed = pack_get<uint64_t>(buf, pos);
+	game.dungeon = pack_get<uint64_t>(buf, pos);
+	game.numnpcs = pack_get<uint32_t>(buf, pos);
+	game.numobjs = pack_get<uint32_t>(buf, pos);
+	game.height = pack_get<uint16_t>(buf, pos);
+	game.width = pack_get<uint16_t>(buf, pos);
+	uint8_t const origin = pack_get<uint8_t>(buf, pos);
+
+	if (origin > JOURNAL_SNAPSHOT) {
+		return false;
+	}
+
+	game.origin = (journal_origin)origin;
+
+	keys.clear();
+	ended = false;
+
+	/* a torn last key is dropped */
+	while (buf.size() - pos >= sizeof(int32_t)) {
+		int32_t const k = pack_get<int32_t>(buf, pos);
+
+		if (k == END) {
+			ended = true;
+			break;
+		}
+
+		keys.push_back(k);
+	}
+
+	return true;
+}
+
+static void
+create()
+{
+	std::string const path = opal_dir() + FILEPATH;
+
+	if ((fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600))
+		== -1) {
+		err(1, "journal open");
+	}
+
+	pending.assign(MARK, MARK + MARK_L);
+	pack_put<uint32_t>(pending, JOURNAL_VERSION);
+	pack_put<uint64_t>(pending, game.nonce);
+	pack_put<uint64_t>(pending, game.base);
+	pack_put<uint64_t>(pending, game.seed);
+	pack_put<uint64_t>(pending, game.dungeon);
+	pack_put<uint32_t>(pending, game.numnpcs);
+	pack_put<uint32_t>(pending, game.numobjs);
+	pack_put<uint16_t>(pending, game.height);
+	pack_put<uint16_t>(pending, game.width);
+	pack_put<uint8_t>(pending, (uint8_t)game.origin);
+
+	flush();
+}
+
+/* keep the header and count keys, appending after them */
+static void
+open_append(std::size_t const count)
+{
+	std::string const path = opal_path() + FILEPATH;
+
+	if ((fd = open(path.c_str(), O_WRONLY)) == -1) {
+		err(1, "journal open");
+	}
+
+	if (ftruncate(fd, (off_t)(HEADER_L + count * sizeof(int32_t)))
+		== -1) {
+		err(1, "journal ftruncate");
+	}
+
+	if (lseek(fd, 0, SEEK_END) == -1) {
+		err(1, "journal lseek");
+	}
+}
+
+static void
+flush()
+{
+	std::size_t off = 0;
+
+	while (off < pending.size()) {
+		ssize_t const n = write(fd, pending.data() + off,
+			pending.size() - off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			err(1, "journal write");
+		}
+
+		off += (std::size_t)n;
+	}
+
+	pending.clear();
+}
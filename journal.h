@@ -0,0 +1,61 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <ncurses.h>
+
+enum journal_origin {
+	JOURNAL_NEW,
+	JOURNAL_LOADED,
+	JOURNAL_SNAPSHOT
+};
+
+/*
+ * What the keys of a journal play out from: a new game with the options
+ * as given on the command line, a loaded dungeon, or a snapshot. A loaded
+ * dungeon is known by its hash, see dungeon_hash.
+ */
+struct journal_game {
+	uint64_t		nonce;
+	uint64_t		base;
+	uint64_t		seed;
+	uint64_t		dungeon;
+	uint32_t		numnpcs;
+	uint32_t		numobjs;
+	uint16_t		height;
+	uint16_t		width;
+	journal_origin		origin;
+};
+
+void			journal_start(journal_game &);
+enum journal_origin	journal_recover(journal_game &);
+void			journal_stop(bool const);
+
+int	journal_key(WINDOW *const);
+bool	journal_replaying();
+
+/* snapshots */
+void	journal_save(std::vector<uint8_t> &);
+void	journal_load(std::vector<uint8_t> const &, std::size_t &);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,117 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef KEYWORD_H
+#define KEYWORD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+template<typename T> struct keyword {
+	std::string_view	key;
+	T			val;
+};
+
+/*
+ * A perfect hash table of keywords, built at compile time. The seed of the
+ * hash is searched for one under which no two keywords share a slot, so a
+ * lookup hashes once and compares against at most one keyword.
+ */
+template<typename T, std::size_t N> class keyword_table {
+	static std::size_t constexpr
+	slots_for(std::size_t const n)
+	{
+		std::size_t s = 1;
+
+		while (s < 2 * n) {
+			s *= 2;
+		}
+
+		return s;
+	}
+
+	static std::size_t constexpr SLOTS = slots_for(N);
+
+	std::array<keyword<T>, SLOTS>	slot{};
+	std::array<bool, SLOTS>		used{};
+	uint64_t			seed = 0;
+
+	/* FNV-1a from the seed, the high bits picking the slot */
+	static constexpr std::size_t
+	hash(std::string_view const s, uint64_t const seed)
+	{
+		uint64_t h = 0xCBF29CE484222325 ^ seed;
+
+		for (auto const c : s) {
+			h = (h ^ (uint8_t)c) * 0x100000001B3;
+		}
+
+		return (std::size_t)(h >> 32) & (SLOTS - 1);
+	}
+
+	static constexpr bool
+	perfect(keyword<T> const (&kw)[N], uint64_t const seed)
+	{
+		std::array<bool, SLOTS> taken{};
+
+		for (auto const &k : kw) {
+			std::size_t const h = hash(k.key, seed);
+
+			if (taken[h]) {
+				return false;
+			}
+
+			taken[h] = true;
+		}
+
+		return true;
+	}
+public:
+	constexpr
+	keyword_table(keyword<T> const (&kw)[N])
+	{
+		while (!perfect(kw, seed)) {
+			seed++;
+		}
+
+		for (auto const &k : kw) {
+			std::size_t const h = hash(k.key, seed);
+
+			slot[h] = k;
+			used[h] = true;
+		}
+	}
+
+	/* NULL if s is not a keyword */
+	constexpr T const *
+	find(std::string_view const s) const
+	{
+		std::size_t const h = hash(s, seed);
+
+		return used[h] && slot[h].key == s ? &slot[h].val : nullptr;
+	}
+};
+
+template<typename T, std::size_t N> constexpr keyword_table<T, N>
+keywords(keyword<T> const (&kw)[N])
+{
+	return keyword_table<T, N>(kw);
+}
+
+#endif /* KEYWORD_H */
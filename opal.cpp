@@ -24,9 +24,16 @@
 #include <err.h>
 #include <getopt.h>
 
+#include "cache.h"
+#include "desc.h"
+#include "dice.h"
+#include "dijk.h"
 #include "gen.h"
 #include "globs.h"
-#include "parse.h"
+#include "journal.h"
+#include "pool.h"
+#include "snap.h"
+#include "store.h"
 #include "turn.h"
 
 static bool	colors();
@@ -36,28 +43,83 @@ static void	print_winscreen1(WINDOW *const);
 static void	print_winscreen2(WINDOW *const);
 
 static bool	is_number(std::string const &);
+static int	dimension(char const *const, char const *const, int const);
+
+/*
+ * One worker per distance map, one generating the next floor, and one
+ * writing saves.
+ */
+static unsigned int constexpr POOL_WORKERS = 4;
+
+/* default memory budget of the floor cache, in KiB */
+static std::size_t constexpr CACHE_KIB = 16384;
 
 npc player;
 
+/* the PC is not described by any file */
+static npc_proto pc;
+
 int
 main(int const argc, char *const argv[])
 {
 	WINDOW *win;
+	journal_game game;
 	char *end;
-	char const *const usage = "usage: opal [-ls] [-n count] [-o count] [-z seed]";
+	char const *const usage = "usage: opal [-lrst] [-a turns] [-c kib] [-H height] "
+		"[-n count] [-o count] [-W width] [-z seed]";
 	int opt;
+	int height;
+	int width;
+	std::size_t cache_kib;
+	unsigned int autosave;
 	unsigned int numnpcs;
 	unsigned int numobjs;
 	bool load;
+	bool resume;
 	bool save;
+	bool transform;
+	enum turn_exit ret;
 
+	autosave = 0;
+	cache_kib = CACHE_KIB;
 	numnpcs = std::numeric_limits<unsigned int>::max();
 	numobjs = std::numeric_limits<unsigned int>::max();
+	height = HEIGHT;
+	width = WIDTH;
 	load = false;
+	resume = false;
 	save = false;
+	transform = false;
 
-	while ((opt = getopt(argc, argv, "ln:o:sz:")) != -1) {
+	while ((opt = getopt(argc, argv, "H:W:a:c:ln:o:rstz:")) != -1) {
 		switch(opt) {
+		case 'a':
+			autosave = (unsigned int)strtoul(optarg, &end, 10);
+
+			if (errno == EINVAL || errno == ERANGE) {
+				err(1, "autosave interval invalid");
+			} else if (optarg == end) {
+				errx(1, "autosave interval invalid");
+			}
+
+			break;
+		case 'c':
+			cache_kib = strtoul(optarg, &end, 10);
+
+			if (errno == EINVAL || errno == ERANGE) {
+				err(1, "cache budget invalid");
+			} else if (optarg == end
+				|| cache_kib > SIZE_MAX / 1024) {
+				errx(1, "cache budget invalid");
+			}
+
+			break;
+		case 'H':
+			height = dimension("height", optarg, HEIGHT);
+			break;
+		case 'W':
+			width = dimension("width", optarg, WIDTH);
+			break;
 		case 'l':
 			load = true;
 			break;
@@ -80,10 +142,16 @@ main(int const argc, char *const argv[])
 				errx(1, "numobjs invalid");
 			}
 
+			break;
+		case 'r':
+			resume = true;
 			break;
 		case 's':
 			save = true;
 			break;
+		case 't':
+			transform = true;
+			break;
 		case 'z':
 			if (is_number(optarg)) {
 				rr = ranged_random(strtoul(optarg, &end, 10));
@@ -108,6 +176,40 @@ main(int const argc, char *const argv[])
 		errx(1, usage);
 	}
 
+	/* a loaded map keeps the size it was saved with */
+	if (load && (height != HEIGHT || width != WIDTH)) {
+		errx(1, "-l takes the map size from the saved dungeon");
+	}
+
+	if (resume && (load || height != HEIGHT || width != WIDTH)) {
+		errx(1, "-r takes the dungeon from the saved game");
+	}
+
+	if (resume && journal_recover(game) != JOURNAL_SNAPSHOT) {
+		/* start over as the journal's game did, then play it back */
+		rr = ranged_random(game.seed);
+		numnpcs = game.numnpcs;
+		numobjs = game.numobjs;
+		height = game.height;
+		width = game.width;
+		load = game.origin == JOURNAL_LOADED;
+		resume = false;
+	} else if (resume) {
+		/* descriptions roll from the seed, snap_load does the rest */
+		rr = ranged_random(game.seed);
+	} else {
+		game.seed = rr.seed;
+		game.numnpcs = numnpcs;
+		game.numobjs = numobjs;
+		game.height = (uint16_t)height;
+		game.width = (uint16_t)width;
+		game.dungeon = load ? dungeon_hash() : 0;
+		game.origin = load ? JOURNAL_LOADED : JOURNAL_NEW;
+		journal_start(game);
+	}
+
+	tiles.resize(height, width);
+
 	if (numnpcs == std::numeric_limits<unsigned int>::max()) {
 		numnpcs = rr.rrand<unsigned int>(3, 10);
 	}
@@ -116,6 +218,11 @@ main(int const argc, char *const argv[])
 		numobjs = rr.rrand<unsigned int>(10, 15);
 	}
 
+	dijkstra_init(transform);
+	snap_every(autosave);
+	cache_init(cache_kib * 1024);
+	pool_start(POOL_WORKERS);
+
 	(void)initscr();
 
 	if (!colors()) {
@@ -123,8 +230,7 @@ main(int const argc, char *const argv[])
 	}
 
 	/* requires colors initialized */
-	parse_npc_file();
-	parse_obj_file();
+	desc_load();
 
 	if (refresh() == ERR) {
 		errx(1, "refresh from initscr");
@@ -152,45 +258,37 @@ main(int const argc, char *const argv[])
 		errx(1, "keypad");
 	}
 
-	clear_tiles();
-
-	if (load) {
-		if (!load_dungeon()) {
-			errx(1, "loading dungeon");
-		}
+	pc.color = COLOR_PAIR(COLOR_YELLOW);
+	pc.dam = {0, 1, 4};
+	pc.symb = PLAYER;
+	pc.type = PLAYER_TYPE;
+	player.proto = &pc;
 
-		arrange_loaded();
+	if (resume) {
+		snap_load();
 	} else {
-		arrange_new();
-	}
+		turn_seed();
+		level_first(load, numnpcs, numobjs);
 
-	player.color = COLOR_PAIR(COLOR_YELLOW);
-	player.dam = {0, 1, 4};
-	player.hp = rr.rand_dice<uint64_t>(50, 30, 5);
-	player.speed = 10;
-	player.symb = PLAYER;
-	player.turn = 0;
-	player.type = PLAYER_TYPE;
+		player.hp = rr.rand_dice<uint64_t>(50, 30, 5);
+		player.speed = 10;
+		player.turn = 0;
+	}
 
 	retry:
-	switch(turn_engine(win, numnpcs, numobjs)) {
+	switch((ret = turn_engine(win))) {
 	case TURN_DEATH:
 		std::this_thread::sleep_for(std::chrono::seconds(1));
 		print_deathscreen(win);
 		std::this_thread::sleep_for(std::chrono::seconds(1));
 		break;
-	case TURN_NEXT:
+	case TURN_DN:
+	case TURN_UP:
 		if (werase(win) == ERR) {
-			errx(1, "arrange_renew erase");
+			errx(1, "level_next erase");
 		}
 
-		arrange_renew();
-
-		for (auto &n : npcs_parsed) {
-			if (n.type & BOSS) {
-				n.done = false;
-			}
-		}
+		level_next(ret == TURN_DN);
 
 		player.turn = 0;
 
@@ -221,10 +319,30 @@ main(int const argc, char *const argv[])
 
 	std::cout << "seed: " << rr.seed << '\n';
 
+	/* only a game left by quitting can be picked up again */
+	if (save && ret == TURN_QUIT) {
+		snap_save();
+	}
+
 	if (save && !save_dungeon()) {
 		errx(1, "saving dungeon");
 	}
 
+	journal_stop(ret != TURN_QUIT || !save);
+	store_wait();
+	level_stop();
+	pool_stop();
+
+#ifdef DEBUG
+	dijkstra_stats(stdout);
+	level_stats(stdout);
+	store_stats(stdout);
+	dice_stats(stdout);
+	desc_stats(stdout);
+#endif
+
+	cache_stop();
+
 	return EXIT_SUCCESS;
 }
 
@@ -349,3 +467,19 @@ is_number(std::string const &s)
 		return !std::isdigit(c);
 	}) == s.end();
 }
+
+/* map dimensions range from the screen size up to DIM_MAX */
+static int
+dimension(char const *const name, char const *const arg, int const min)
+{
+	char *end;
+	unsigned long const val = strtoul(arg, &end, 10);
+
+	if (arg == end || *end != '\0' || val < (unsigned long)min
+		|| val > DIM_MAX) {
+		errx(1, "%s %s invalid, must be %d to %d", name, arg, min,
+			DIM_MAX);
+	}
+
+	return (int)val;
+}
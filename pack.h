@@ -0,0 +1,82 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <err.h>
+
+/*
+ * Native-endian packing of in-process state, for the floor cache, game
+ * snapshots and the description pack. None is meant to move between
+ * machines.
+ */
+template<typename T> void
+pack_put(std::vector<uint8_t> &buf, T const val)
+{
+	uint8_t b[sizeof(T)];
+
+	std::memcpy(b, &val, sizeof(T));
+	buf.insert(buf.end(), b, b + sizeof(T));
+}
+
+/* from memory that is not a vector, such as a mapped file */
+template<typename T> T
+pack_get(uint8_t const *const buf, std::size_t const len, std::size_t &pos)
+{
+	T val;
+
+	if (len - pos < sizeof(T)) {
+		errx(1, "packed state truncated");
+	}
+
+	std::memcpy(&val, buf + pos, sizeof(T));
+	pos += sizeof(T);
+
+	return val;
+}
+
+/* as pack_get into out, but false rather than exiting if buf runs short */
+template<typename T, typename U> bool
+pack_take(uint8_t const *const buf, std::size_t const len, std::size_t &pos,
+	U &out)
+{
+	T val;
+
+	if (len - pos < sizeof(T)) {
+		return false;
+	}
+
+	std::memcpy(&val, buf + pos, sizeof(T));
+	pos += sizeof(T);
+	out = val;
+
+	return true;
+}
+
+template<typename T> T
+pack_get(std::vector<uint8_t> const &buf, std::size_t &pos)
+{
+	return pack_get<T>(buf.data(), buf.size(), pos);
+}
+
+#endif /* PACK_H */
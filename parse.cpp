@@ -15,17 +15,29 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <err.h>
-#include <sys/stat.h>
 
 #include "gen.h"
 #include "globs.h"
+#include "parse.h"
+#include "pool.h"
+#include "store.h"
 #include "y.tab.h"
+#include "lex.yy.h"
 
-static char const *const NPC_FILE = "/npc_desc";
-static char const *const OBJ_FILE = "/obj_desc";
+static void	parse_npcs();
+static void	parse_objs();
+static parse_result	parse_file(char const *const);
+
+static std::size_t constexpr ARENA_BLOCK = 64 * 1024;
 
 static char const *const color_map_r[] = {
 	"BLACK",
@@ -60,58 +72,109 @@ static char const *const type_map_r[] = {
 	"WEAPON"
 };
 
-extern int	yyparse();
-extern FILE	*yyin;
+std::vector<npc_proto> npcs_parsed;
+std::vector<obj_proto> objs_parsed;
+std::vector<npc_dice> npc_rolls;
+std::vector<obj_dice> obj_rolls;
 
-std::vector<npc> npcs_parsed;
-std::vector<obj> objs_parsed;
+/* kept for their text, which the parsed descriptions view */
+static parse_result npc_res;
+static parse_result obj_res;
 
-void
-parse_npc_file()
+static pool_job job_npcs = { "parse_npcs", parse_npcs, {}, {}, {} };
+static pool_job job_objs = { "parse_objs", parse_objs, {}, {}, {} };
+
+/*
+ * A description file in memory. The scanner and parser keep all their
+ * state in a parse_ctx of the call, so files can be parsed concurrently.
+ */
+parse_result
+parse_descriptions(char const *const buf, std::size_t const len)
 {
-	struct stat st;
-	std::string const path = opal_path() + NPC_FILE;
+	parse_ctx ctx{};
+	yyscan_t scanner;
 
-	if (stat(path.c_str(), &st) == -1) {
-		err(1, "npc description file");
+	if (len > INT_MAX) {
+		errx(1, "description file too large");
 	}
 
-	yyin = fopen(path.c_str(), "r");
-
-	if (yyin == NULL) {
-		err(1, "npc file fopen");
+	if (yylex_init(&scanner) != 0) {
+		err(1, "yylex_init");
 	}
 
-	if (yyparse() != 0) {
-		errx(1, "yyparse npcs");
+	(void)yy_scan_bytes(buf, (int)len, scanner);
+
+	if (yyparse(scanner, ctx) != 0) {
+		errx(1, "yyparse descriptions");
 	}
 
-	if (fclose(yyin) == EOF) {
-		err(1, "npc fclose");
+	(void)yylex_destroy(scanner);
+
+	return std::move(ctx.res);
+}
+
+std::string_view
+text_arena::keep(std::string_view const s)
+{
+	if (s.size() > cap - used) {
+		cap = std::max(s.size(), ARENA_BLOCK);
+		used = 0;
+		blocks.emplace_back(new char[cap]);
 	}
+
+	char *const p = blocks.back().get() + used;
+
+	std::memcpy(p, s.data(), s.size());
+	used += s.size();
+
+	return std::string_view(p, s.size());
 }
 
+/* both description files, each on a pool worker */
 void
-parse_obj_file()
+parse_files()
 {
-	struct stat st;
-	std::string const path = opal_path() + OBJ_FILE;
+	pool_token token(2);
 
-	if (stat(path.c_str(), &st) == -1) {
-		err(1, "object description file");
-	}
+	pool_submit(job_npcs, token);
+	pool_submit(job_objs, token);
+	pool_wait(token);
 
-	yyin = fopen(path.c_str(), "r");
+	npcs_parsed = std::move(npc_res.npcs);
+	npc_rolls = std::move(npc_res.npc_rolls);
+	objs_parsed = std::move(obj_res.objs);
+	obj_rolls = std::move(obj_res.obj_rolls);
+}
 
-	if (yyin == NULL) {
-		err(1, "object file fopen");
-	}
+void
+parse_stats(FILE *const f)
+{
+	pool_print(f, job_npcs);
+	pool_print(f, job_objs);
+}
 
-	if (yyparse() != 0) {
-		errx(1, "yyparse objs");
-	}
+static void
+parse_npcs()
+{
+	npc_res = parse_file(NPC_FILE);
+}
+
+static void
+parse_objs()
+{
+	obj_res = parse_file(OBJ_FILE);
+}
 
-	if (fclose(yyin) == EOF) {
-		err(1, "object fclose");
+static parse_result
+parse_file(char const *const file)
+{
+	std::vector<uint8_t> buf;
+	std::string const path = opal_path() + file;
+
+	if (!store_read(path, buf, SIZE_MAX)) {
+		err(1, "description file %s", path.c_str());
 	}
+
+	return parse_descriptions(reinterpret_cast<char const *>(buf.data()),
+		buf.size());
 }
@@ -18,7 +18,87 @@
 #ifndef PARSE_H
 #define PARSE_H
 
-void	parse_npc_file();
-void	parse_obj_file();
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "globs.h"
+
+/* under opal_path() */
+char const *const NPC_FILE = "/npc_desc";
+char const *const OBJ_FILE = "/obj_desc";
+
+/*
+ * The dice format values of a description, rolled once a game by
+ * desc_load in this order. WEIGHT sets VAL, as it always has.
+ */
+enum npc_roll {
+	NPC_HP,
+	NPC_SPEED,
+	NPC_ROLLS
+};
+
+enum obj_roll {
+	OBJ_ATTR,
+	OBJ_DEF,
+	OBJ_DODGE,
+	OBJ_HIT,
+	OBJ_SPEED,
+	OBJ_VAL,
+	OBJ_ROLLS
+};
+
+using npc_dice = std::array<dice, NPC_ROLLS>;
+using obj_dice = std::array<dice, OBJ_ROLLS>;
+
+/* alongside npcs_parsed and objs_parsed */
+extern std::vector<npc_dice> npc_rolls;
+extern std::vector<obj_dice> obj_rolls;
+
+/*
+ * Storage for the names and descriptions of a file, which the descriptions
+ * and everything spawned from them view for the rest of the game. Text is
+ * copied in once and never moves.
+ */
+class text_arena {
+	std::vector<std::unique_ptr<char[]>>	blocks;
+	std::size_t				used = 0;
+	std::size_t				cap = 0;
+public:
+	std::string_view	keep(std::string_view const);
+};
+
+/* what one description file holds */
+struct parse_result {
+	std::vector<npc_proto>	npcs;
+	std::vector<obj_proto>	objs;
+	std::vector<npc_dice>	npc_rolls;
+	std::vector<obj_dice>	obj_rolls;
+	text_arena		text;
+};
+
+/*
+ * The parser's state while it runs, all of it, see parse.y. The name and
+ * description of the entry being parsed grow in buffers reused from one
+ * entry to the next.
+ */
+struct parse_ctx {
+	parse_result	res;
+	npc_proto	n;
+	obj_proto	o;
+	npc_dice	n_dice;
+	obj_dice	o_dice;
+	std::string	name;
+	std::string	desc;
+};
+
+parse_result	parse_descriptions(char const *const, std::size_t const);
+
+void	parse_files();
+void	parse_stats(FILE *const);
 
 #endif /* PARSE_H */
@@ -16,30 +16,29 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-#include <cstring>
-#include <unordered_map>
+#include <array>
+#include <charconv>
+#include <string_view>
 
 #include <err.h>
 
 #include "globs.h"
+#include "keyword.h"
+#include "parse.h"
 
-extern int	yylex();
+template<typename T, std::size_t N>
+static T	lookup(keyword_table<T, N> const &, std::string_view const);
 
-static void	yyerror(char const *const);
+static void	start(parse_ctx &);
+static void	finish(parse_ctx &, dungeon_thing &);
 
-static dice	parse_dice(char *const);
-static uint64_t	parse_dice_value(char *const);
-static uint8_t	parse_rrty(char *const);
+static dice	parse_dice(std::string_view);
+static uint8_t	parse_rrty(std::string_view const);
+static uint64_t	parse_u64(std::string_view const, char const *const);
 
-bool in_n;
-bool in_o;
+static std::size_t constexpr line_max = 77;
 
-npc c_npc;
-obj c_obj;
-
-static int constexpr line_max = 77;
-
-static std::unordered_map<std::string, int> const color_map = {
+static auto constexpr color_map = keywords<int>({
 	{"BLACK", COLOR_PAIR(COLOR_BLACK)},
 	{"BLUE", COLOR_PAIR(COLOR_BLUE)},
 	{"CYAN", COLOR_PAIR(COLOR_CYAN)},
@@ -48,9 +47,9 @@ static std::unordered_map<std::string, int> const color_map = {
 	{"RED", COLOR_PAIR(COLOR_RED)},
 	{"WHITE", COLOR_PAIR(COLOR_WHITE)},
 	{"YELLOW", COLOR_PAIR(COLOR_YELLOW)}
-};
+});
 
-static std::unordered_map<std::string, uint16_t> const ability_map = {
+static auto constexpr ability_map = keywords<uint16_t>({
 	{"BOSS", BOSS},
 	{"DESTROY", DESTROY},
 	{"ERRATIC", ERRATIC},
@@ -60,32 +59,32 @@ static std::unordered_map<std::string, uint16_t> const ability_map = {
 	{"TELE", TELE},
 	{"TUNNEL", TUNNEL},
 	{"UNIQ", UNIQ}
+});
+
+/* indexed by type */
+static std::array<char, weapon + 1> constexpr type_symb = {
+	'/',	/* ammunition */
+	'"',	/* amulet */
+	'[',	/* armor */
+	'?',	/* book */
+	'\\',	/* boots */
+	'(',	/* cloak */
+	'%',	/* container */
+	'!',	/* flask */
+	',',	/* food */
+	'{',	/* gloves */
+	'$',	/* gold */
+	']',	/* helmet */
+	'_',	/* light */
+	')',	/* offhand */
+	'}',	/* ranged */
+	'=',	/* ring */
+	'~',	/* scroll_type */
+	'-',	/* wand */
+	'|'	/* weapon */
 };
 
-static std::unordered_map<type, char> const type_symb_map = {
-	{ammunition, '/'},
-	{amulet, '"'},
-	{armor, '['},
-	{book, '?'},
-	{boots, '\\'},
-	{cloak, '('},
-	{container, '%'},
-	{flask, '!'},
-	{food, ','},
-	{gloves, '{'},
-	{gold, '$'},
-	{helmet, ']'},
-	{light, '_'},
-	{offhand, ')'},
-	{ranged, '}'},
-	{ring, '='},
-	{scroll_type, '~'},
-	{wand, '-'},
-	{weapon, '|'}
-};
-
-
-static std::unordered_map<std::string, type> const type_map = {
+static auto constexpr type_map = keywords<type>({
 	{"AMMUNITION", ammunition},
 	{"AMULET", amulet},
 	{"ARMOR", armor},
@@ -105,12 +104,32 @@ static std::unordered_map<std::string, type> const type_map = {
 	{"SCROLL", scroll_type},
 	{"WAND", wand},
 	{"WEAPON", weapon}
-};
+});
 
 %}
 
-%union {
-	char *str;
+/* reentrant, so several files can be parsed at once; see parse.cpp */
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {parse_ctx &ctx}
+
+%code requires {
+#include <string_view>
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+struct parse_ctx;
+}
+
+/* every token's text, viewing the scanner's buffer until the next token */
+%define api.value.type {std::string_view}
+
+%code {
+int		yylex(YYSTYPE *, yyscan_t);
+static void	yyerror(yyscan_t, parse_ctx &, char const *const);
 }
 
 %token BEGIN_NPC_FILE BEGIN_OBJ_FILE
@@ -119,12 +138,7 @@ static std::unordered_map<std::string, type> const type_map = {
 %token ABIL HP SYMB
 %token ART ATTR DEF DODGE HIT TYPE VAL WEIGHT
 
-%token <str> ABILS
-%token <str> BOOLEAN
-%token <str> COLORS
-%token <str> DESC_INNER
-%token <str> STR
-%token <str> TYPES
+%token ABILS BOOLEAN COLORS DESC_INNER STR TYPES
 
 %%
 
@@ -139,7 +153,16 @@ npcs
 	;
 
 npc
-	: BEGIN_NPC npc_keywords END
+	: BEGIN_NPC		{
+					ctx.n = {};
+					ctx.n_dice = {};
+					start(ctx);
+				}
+	  npc_keywords END	{
+					finish(ctx, ctx.n);
+					ctx.res.npcs.push_back(ctx.n);
+					ctx.res.npc_rolls.push_back(ctx.n_dice);
+				}
 	;
 
 npc_keywords
@@ -149,19 +172,19 @@ npc_keywords
 
 npc_keyword
 	: ABIL abil
-	| COLOR COLORS	{ c_npc.color = color_map.at($2); }
-	| DAM STR	{ c_npc.dam = parse_dice($2); }
+	| COLOR COLORS	{ ctx.n.color = lookup(color_map, $2); }
+	| DAM STR	{ ctx.n.dam = parse_dice($2); }
 	| DESC desc DESC_END
-	| HP STR	{ c_npc.hp = parse_dice_value($2); }
+	| HP STR	{ ctx.n_dice[NPC_HP] = parse_dice($2); }
 	| NAME name
-	| RRTY STR	{ c_npc.rrty = parse_rrty($2); }
-	| SPEED STR	{ c_npc.speed = parse_dice_value($2); }
-	| SYMB STR	{ c_npc.symb = $2[0]; }
+	| RRTY STR	{ ctx.n.rrty = parse_rrty($2); }
+	| SPEED STR	{ ctx.n_dice[NPC_SPEED] = parse_dice($2); }
+	| SYMB STR	{ ctx.n.symb = $2[0]; }
 	;
 
 abil
-	: ABILS		{ c_npc.type |= ability_map.at($1); }
-	| abil ABILS	{ c_npc.type |= ability_map.at($2); }
+	: ABILS		{ ctx.n.type |= lookup(ability_map, $1); }
+	| abil ABILS	{ ctx.n.type |= lookup(ability_map, $2); }
 	;
 
 objs
@@ -170,7 +193,16 @@ objs
 	;
 
 obj
-	: BEGIN_OBJ obj_keywords END
+	: BEGIN_OBJ		{
+					ctx.o = {};
+					ctx.o_dice = {};
+					start(ctx);
+				}
+	  obj_keywords END	{
+					finish(ctx, ctx.o);
+					ctx.res.objs.push_back(ctx.o);
+					ctx.res.obj_rolls.push_back(ctx.o_dice);
+				}
 	;
 
 obj_keywords
@@ -179,91 +211,100 @@ obj_keywords
 	;
 
 obj_keyword
-	: ART BOOLEAN	{ c_obj.art = std::strcmp($2, "TRUE") == 0; }
-	| ATTR STR	{ c_obj.attr = parse_dice_value($2); }
-	| COLOR COLORS	{ c_obj.color = color_map.at($2); }
-	| DAM STR	{ c_obj.dam = parse_dice($2); }
-	| DEF STR	{ c_obj.def = parse_dice_value($2); }
+	: ART BOOLEAN	{ ctx.o.art = $2 == "TRUE"; }
+	| ATTR STR	{ ctx.o_dice[OBJ_ATTR] = parse_dice($2); }
+	| COLOR COLORS	{ ctx.o.color = lookup(color_map, $2); }
+	| DAM STR	{ ctx.o.dam = parse_dice($2); }
+	| DEF STR	{ ctx.o_dice[OBJ_DEF] = parse_dice($2); }
 	| DESC desc DESC_END
-	| DODGE STR	{ c_obj.dodge = parse_dice_value($2); }
-	| HIT STR	{ c_obj.hit = parse_dice_value($2); }
+	| DODGE STR	{ ctx.o_dice[OBJ_DODGE] = parse_dice($2); }
+	| HIT STR	{ ctx.o_dice[OBJ_HIT] = parse_dice($2); }
 	| NAME name
-	| RRTY STR	{ c_obj.rrty = parse_rrty($2); }
-	| SPEED STR	{ c_obj.speed = parse_dice_value($2); }
+	| RRTY STR	{ ctx.o.rrty = parse_rrty($2); }
+	| SPEED STR	{ ctx.o_dice[OBJ_SPEED] = parse_dice($2); }
 	| TYPE TYPES	{
-				c_obj.obj_type = type_map.at($2);
-				c_obj.symb = type_symb_map.at(c_obj.obj_type);
+				ctx.o.obj_type = lookup(type_map, $2);
+				ctx.o.symb = type_symb[ctx.o.obj_type];
 			}
-	| VAL STR	{ c_obj.val = parse_dice_value($2); }
-	| WEIGHT STR	{ c_obj.val = parse_dice_value($2); }
+	| VAL STR	{ ctx.o_dice[OBJ_VAL] = parse_dice($2); }
+	| WEIGHT STR	{ ctx.o_dice[OBJ_VAL] = parse_dice($2); }
 	;
 
 name
-	: STR		{
-				if (in_n) c_npc.name += $1;
-				if (in_o) c_obj.name += $1;
-			}
-	| name STR	{
-				if (in_n) c_npc.name = c_npc.name + " " + $2;
-				if (in_o) c_obj.name = c_obj.name + " " + $2;
-			}
+	: STR		{ ctx.name.append($1); }
+	| name STR	{ ctx.name.append(" ").append($2); }
 	;
 
 desc
-	: DESC_INNER		{
-					if (strlen($1) > line_max + 1) {
-						yyerror("line too long");
-					}
-					if (in_n) c_npc.desc += $1;
-					if (in_o) c_obj.desc += $1;
-				}
-	| desc DESC_INNER	{
-					if (strlen($2) > line_max + 1) {
-						yyerror("line too long");
-					}
-					if (in_n) c_npc.desc += $2;
-					if (in_o) c_obj.desc += $2;
+	: desc_line
+	| desc desc_line
+	;
+
+desc_line
+	: DESC_INNER	{
+				if ($1.size() > line_max + 1) {
+					yyerror(scanner, ctx, "line too long");
 				}
+
+				ctx.desc.append($1);
+			}
 	;
 
 %%
 
 static void
-yyerror(char const *const s)
+yyerror(yyscan_t, parse_ctx &, char const *const s)
 {
 	errx(1, "%s", s);
 }
 
+static void
+start(parse_ctx &ctx)
+{
+	ctx.name.clear();
+	ctx.desc.clear();
+}
 
-static dice
-parse_dice(char *const s)
+/* the text of an entry, into the arena of the file */
+static void
+finish(parse_ctx &ctx, dungeon_thing &t)
 {
-	dice d;
-	char *p, *last;
+	t.name = ctx.res.text.keep(ctx.name);
+	t.desc = ctx.res.text.keep(ctx.desc);
+}
 
-	p = strtok_r(s, "+", &last);
+template<typename T, std::size_t N> static T
+lookup(keyword_table<T, N> const &t, std::string_view const s)
+{
+	T const *const val = t.find(s);
 
-	if (p == NULL) {
-		errx(1, "dice formatted incorrectly");
+	if (val == nullptr) {
+		errx(1, "unknown keyword '%.*s'", (int)s.size(), s.data());
 	}
 
-	d.base = (uint64_t)std::atoll(p);
+	return *val;
+}
 
-	p = strtok_r(NULL, "d", &last);
+/* base+dicedsides */
+static dice
+parse_dice(std::string_view s)
+{
+	dice d;
+	std::size_t const plus = s.find('+');
 
-	if (p == NULL) {
-		errx(1, "dice formatted incorrectly");
+	if (plus == std::string_view::npos) {
+		errx(1, "dice format missing '+'");
 	}
 
-	d.dice = (uint64_t)std::atoll(p);
+	std::size_t const die = s.find('d', plus);
 
-	p = strtok_r(NULL, "\0", &last);
-
-	if (p == NULL) {
-		errx(1, "dice format missing '+'");
+	if (die == std::string_view::npos) {
+		errx(1, "dice formatted incorrectly");
 	}
 
-	d.sides = (uint64_t)std::atoll(p);
+	d.base = parse_u64(s.substr(0, plus), "dice base");
+	d.dice = parse_u64(s.substr(plus + 1, die - plus - 1), "dice count");
+	d.sides = parse_u64(s.substr(die + 1), "dice sides");
 
 	if (d.sides == 1 && d.dice != 0) {
 		errx(1, "instead of using multiple 1-sided die, add them as "
@@ -273,21 +314,30 @@ parse_dice(char *const s)
 	return d;
 }
 
-static uint64_t
-parse_dice_value(char *const s)
+static uint8_t
+parse_rrty(std::string_view const s)
 {
-	dice const d = parse_dice(s);
-	return rr.rand_dice<uint64_t>(d.base, d.dice, d.sides);
+	uint64_t const rrty = parse_u64(s, "rrty");
+
+	if (rrty == 0 || rrty > 100) {
+		errx(1, "rrty '%.*s' out of bounds [1, 100]", (int)s.size(),
+			s.data());
+	}
+
+	return (uint8_t)rrty;
 }
 
-static uint8_t
-parse_rrty(char *const s)
+/* the whole of s, in decimal */
+static uint64_t
+parse_u64(std::string_view const s, char const *const what)
 {
-	uint8_t const rrty = (uint8_t)std::atoi(s);
+	uint64_t val = 0;
+	char const *const end = s.data() + s.size();
+	auto const [p, ec] = std::from_chars(s.data(), end, val);
 
-	if (rrty == 0 || rrty > 100) {
-		errx(1, "rrty '%d' out of bounds [1, 100]", rrty);
+	if (ec != std::errc() || p != end) {
+		errx(1, "%s '%.*s' invalid", what, (int)s.size(), s.data());
 	}
 
-	return rrty;
+	return val;
 }
@@ -0,0 +1,269 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <thread>
+
+#include <err.h>
+
+#include "pool.h"
+
+struct pool_task {
+	pool_job					*job;
+	pool_token					*token;
+	std::chrono::steady_clock::time_point		queued;
+};
+
+/*
+ * Bounded multi-producer multi-consumer ring (D. Vyukov). Each slot carries
+ * a sequence number telling producers and consumers whose turn it is, so
+ * neither side takes a lock. The semaphore only parks idle workers.
+ */
+struct pool_slot {
+	std::atomic<std::size_t>	seq;
+	pool_task			task;
+};
+
+static std::size_t constexpr QUEUE_LEN = 64;
+
+static bool	enqueue(pool_task const &);
+static bool	dequeue(pool_task &);
+
+static void	worker();
+static void	account(pool_job &, std::chrono::steady_clock::time_point const);
+
+static pool_slot slots[QUEUE_LEN];
+static std::atomic<std::size_t> head;
+static std::atomic<std::size_t> tail;
+
+static sem_t work;
+static sem_t exited;
+static unsigned int workers;
+
+pool_token::pool_token(unsigned int const n) : pending(n)
+{
+	if (sem_init(&done, 0, 0) == -1) {
+		err(1, "pool_token sem_init");
+	}
+}
+
+pool_token::~pool_token()
+{
+	(void)sem_destroy(&done);
+}
+
+void
+pool_start(unsigned int const n)
+{
+	for (std::size_t i = 0; i < QUEUE_LEN; ++i) {
+		slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	if (sem_init(&work, 0, 0) == -1 || sem_init(&exited, 0, 0) == -1) {
+		err(1, "pool_start sem_init");
+	}
+
+	/*
+	 * Detached, so that exiting through err(3) with workers still parked
+	 * does not run joinable std::thread destructors.
+	 */
+	for (workers = 0; workers < n; ++workers) {
+		std::thread(worker).detach();
+	}
+}
+
+void
+pool_stop()
+{
+	/* a task without a job tells one worker to exit */
+	for (unsigned int i = 0; i < workers; ++i) {
+		while (!enqueue({ nullptr, nullptr, {} })) {
+			std::this_thread::yield();
+		}
+
+		if (sem_post(&work) == -1) {
+			err(1, "pool_stop sem_post");
+		}
+	}
+
+	for (; workers > 0; --workers) {
+		while (sem_wait(&exited) == -1) {
+			if (errno != EINTR) {
+				err(1, "pool_stop sem_wait");
+			}
+		}
+	}
+
+	(void)sem_destroy(&work);
+	(void)sem_destroy(&exited);
+}
+
+void
+pool_submit(pool_job &job, pool_token &token)
+{
+	pool_task const task = { &job, &token,
+		std::chrono::steady_clock::now() };
+
+	while (!enqueue(task)) {
+		std::this_thread::yield();
+	}
+
+	if (sem_post(&work) == -1) {
+		err(1, "pool_submit sem_post");
+	}
+}
+
+void
+pool_wait(pool_token &token)
+{
+	while (sem_wait(&token.done) == -1) {
+		if (errno != EINTR) {
+			err(1, "pool_wait sem_wait");
+		}
+	}
+}
+
+/* whether every job of token has completed, without waiting on it */
+bool
+pool_done(pool_token const &token)
+{
+	return token.pending.load() == 0;
+}
+
+/* run job on the calling thread, counted as if it went through the pool */
+void
+pool_run(pool_job &job)
+{
+	auto const start = std::chrono::steady_clock::now();
+
+	job.fn();
+	account(job, start);
+}
+
+void
+pool_print(FILE *const f, pool_job const &job)
+{
+	uint64_t const count = job.count.load();
+	uint64_t const total = job.total_ns.load();
+
+	(void)fprintf(f, "%s: %" PRIu64 " jobs, mean %" PRIu64 " us, max %"
+		PRIu64 " us\n", job.name, count,
+		count == 0 ? 0 : total / count / 1000, job.max_ns.load() / 1000);
+}
+
+static bool
+enqueue(pool_task const &task)
+{
+	std::size_t pos = tail.load(std::memory_order_relaxed);
+
+	while (1) {
+		pool_slot &s = slots[pos % QUEUE_LEN];
+		std::size_t const seq = s.seq.load(std::memory_order_acquire);
+
+		if (seq == pos) {
+			if (tail.compare_exchange_weak(pos, pos + 1,
+				std::memory_order_relaxed)) {
+				s.task = task;
+				s.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (seq < pos) {
+			/* full */
+			return false;
+		} else {
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static bool
+dequeue(pool_task &task)
+{
+	std::size_t pos = head.load(std::memory_order_relaxed);
+
+	while (1) {
+		pool_slot &s = slots[pos % QUEUE_LEN];
+		std::size_t const seq = s.seq.load(std::memory_order_acquire);
+
+		if (seq == pos + 1) {
+			if (head.compare_exchange_weak(pos, pos + 1,
+				std::memory_order_relaxed)) {
+				task = s.task;
+				s.seq.store(pos + QUEUE_LEN,
+					std::memory_order_release);
+				return true;
+			}
+		} else if (seq < pos + 1) {
+			/* empty */
+			return false;
+		} else {
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static void
+worker()
+{
+	pool_task task;
+
+	while (1) {
+		while (sem_wait(&work) == -1) {
+			if (errno != EINTR) {
+				err(1, "worker sem_wait");
+			}
+		}
+
+		/* every post follows a completed enqueue */
+		while (!dequeue(task)) {
+			std::this_thread::yield();
+		}
+
+		if (task.job == nullptr) {
+			if (sem_post(&exited) == -1) {
+				err(1, "worker sem_post");
+			}
+			return;
+		}
+
+		task.job->fn();
+		account(*task.job, task.queued);
+
+		if (task.token->pending.fetch_sub(1) == 1
+			&& sem_post(&task.token->done) == -1) {
+			err(1, "worker sem_post");
+		}
+	}
+}
+
+static void
+account(pool_job &job, std::chrono::steady_clock::time_point const start)
+{
+	uint64_t const ns = (uint64_t)std::chrono::duration_cast<
+		std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	uint64_t max = job.max_ns.load();
+
+	job.count++;
+	job.total_ns += ns;
+
+	while (ns > max && !job.max_ns.compare_exchange_weak(max, ns)) {
+		continue;
+	}
+}
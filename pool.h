@@ -0,0 +1,59 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include <semaphore.h>
+
+/* a kind of job, with latency counters from submission to completion */
+struct pool_job {
+	char const		*name;
+	void			(*fn)();
+
+	std::atomic<uint64_t>	count;
+	std::atomic<uint64_t>	total_ns;
+	std::atomic<uint64_t>	max_ns;
+};
+
+/* completion token, armed with the number of jobs it waits on */
+struct pool_token {
+	std::atomic<unsigned int>	pending;
+	sem_t				done;
+
+	explicit pool_token(unsigned int const);
+	~pool_token();
+
+	pool_token(pool_token const &) = delete;
+	pool_token &operator=(pool_token const &) = delete;
+};
+
+void	pool_start(unsigned int const);
+void	pool_stop();
+
+void	pool_submit(pool_job &, pool_token &);
+void	pool_wait(pool_token &);
+bool	pool_done(pool_token const &);
+void	pool_run(pool_job &);
+
+void	pool_print(FILE *const, pool_job const &);
+
+#endif /* POOL_H */
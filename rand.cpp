@@ -15,17 +15,89 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+#include <err.h>
+
+#include "pack.h"
 #include "rand.h"
 
+/* generators of fill, and the draws each makes a block */
+static std::size_t constexpr LANES = 8;
+static std::size_t constexpr STEPS = 32;
+
+/* one word of each generator, as SSE2 registers or wider, and a byte */
+typedef uint32_t lanes __attribute__((vector_size(LANES * sizeof(uint32_t))));
+typedef uint8_t octets __attribute__((vector_size(LANES)));
+
+static void	rotl(lanes &, int const);
+static uint64_t	splitmix64(uint64_t &);
+
 ranged_random rr;
 
-ranged_random::ranged_random()
+template class basic_ranged_random<std::mt19937>;
+template class basic_ranged_random<xoshiro256ss>;
+
+xoshiro256ss::xoshiro256ss()
+{
+	seed(0);
+}
+
+xoshiro256ss::xoshiro256ss(uint64_t const x)
+{
+	seed(x);
+}
+
+/* as its authors suggest, expanded by splitmix64, which is never all zero */
+void
+xoshiro256ss::seed(uint64_t x)
+{
+	for (auto &w : s) {
+		w = splitmix64(x);
+	}
+}
+
+void
+xoshiro256ss::seed(std::seed_seq &seq)
+{
+	uint32_t w[8];
+
+	seq.generate(w, w + 8);
+
+	for (std::size_t i = 0; i < 4; ++i) {
+		s[i] = (uint64_t)w[2 * i] << 32 | w[2 * i + 1];
+	}
+
+	if ((s[0] | s[1] | s[2] | s[3]) == 0) {
+		s[0] = 1;
+	}
+}
+
+std::ostream &
+operator<<(std::ostream &out, xoshiro256ss const &x)
+{
+	return out << x.s[0] << ' ' << x.s[1] << ' ' << x.s[2] << ' '
+		<< x.s[3];
+}
+
+std::istream &
+operator>>(std::istream &in, xoshiro256ss &x)
+{
+	return in >> x.s[0] >> x.s[1] >> x.s[2] >> x.s[3];
+}
+
+template<typename Engine>
+basic_ranged_random<Engine>::basic_ranged_random()
 {
 	seed = std::random_device{}();
 	gen.seed(seed);
 }
 
-ranged_random::ranged_random(std::string const &s)
+template<typename Engine>
+basic_ranged_random<Engine>::basic_ranged_random(std::string const &s)
 {
 	long unsigned int hash = 5381;
 
@@ -37,8 +109,195 @@ ranged_random::ranged_random(std::string const &s)
 	gen.seed(seed);
 }
 
-ranged_random::ranged_random(long unsigned int const s)
+template<typename Engine>
+basic_ranged_random<Engine>::basic_ranged_random(long unsigned int const s)
 {
 	seed = s;
 	gen.seed(seed);
 }
+
+/* stream key of seed s for purpose p, see stream */
+template<typename Engine>
+basic_ranged_random<Engine>::basic_ranged_random(long unsigned int const s,
+	rand_stream const p, uint64_t const key)
+{
+	std::vector<uint32_t> words{ (uint32_t)s, (uint32_t)(s >> 32),
+		(uint32_t)key, (uint32_t)(key >> 32) };
+
+	/* floors keep the streams they had before there were purposes */
+	if (p != STREAM_FLOOR) {
+		words.push_back(p);
+	}
+
+	std::seed_seq seq(words.begin(), words.end());
+
+	seed = s;
+	gen.seed(seq);
+}
+
+/*
+ * Fill out with n uniform values in [lo, hi], for whole maps at a time.
+ *
+ * Eight xoshiro128** generators seeded from gen run in lockstep, a block
+ * of STEPS draws each at a time. Each random byte b is mapped by
+ * b * range >> 8 (Lemire), rejecting the few products whose low byte
+ * would make some values more likely than others.
+ *
+ * The generators are a vector type, so drawing a block is SIMD at any
+ * -march. Mapping its bytes carries nothing from one to the next, and
+ * vectorizes on its own. Packing the accepted ones into out copies eight
+ * at a time when none of them was rejected. The bytes come out in the
+ * order of one draw of all eight at a time, so floors keep their seeds.
+ */
+template<typename Engine> void
+basic_ranged_random<Engine>::fill(uint8_t *const out, std::size_t const n,
+	uint8_t const lo, uint8_t const hi)
+{
+	lanes s0, s1, s2, s3;
+	uint8_t bytes[STEPS * sizeof(lanes)];
+	uint8_t vals[sizeof(bytes)];
+	uint8_t keep[sizeof(bytes)];
+	unsigned int const range = hi - lo + 1U;
+	uint16_t const span = (uint16_t)range;
+	uint8_t const threshold = (uint8_t)((256U - range) % range);
+	uint64_t constexpr all = 0x0101010101010101;
+	std::size_t i = 0;
+
+	for (std::size_t k = 0; k < LANES; ++k) {
+		s0[k] = next32();
+		s1[k] = next32();
+		s2[k] = next32();
+
+		/* never all zero */
+		s3[k] = next32() | 1U;
+	}
+
+	while (i < n) {
+		for (std::size_t t = 0; t < STEPS; ++t) {
+			lanes const x = s1 << 9;
+			lanes y = (s1 << 2) + s1;
+
+			rotl(y, 7);
+
+			lanes const w = (y << 3) + y;
+
+			/* byte j of every generator, then byte j + 1 */
+			for (std::size_t j = 0; j < sizeof(uint32_t); ++j) {
+				octets const o = __builtin_convertvector(
+					w >> (j * 8) & 0xFF, octets);
+
+				(void)memcpy(&bytes[(t * sizeof(uint32_t) + j)
+					* LANES], &o, sizeof(o));
+			}
+
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= x;
+			rotl(s3, 11);
+		}
+
+		/* range is at most 256, so the product fits 16 bits */
+		for (std::size_t b = 0; b < sizeof(vals); ++b) {
+			uint16_t const m = (uint16_t)(bytes[b] * span);
+
+			vals[b] = (uint8_t)(lo + (m >> 8));
+			keep[b] = (uint8_t)((uint8_t)m >= threshold);
+		}
+
+		if (n - i < sizeof(vals)) {
+			for (std::size_t b = 0; b < sizeof(vals) && i < n;
+				++b) {
+				if (keep[b]) {
+					out[i++] = vals[b];
+				}
+			}
+
+			continue;
+		}
+
+		/* room for the whole block: store always, keep if accepted */
+		for (std::size_t b = 0; b < sizeof(vals); b += sizeof(all)) {
+			uint64_t k;
+
+			(void)memcpy(&k, &keep[b], sizeof(k));
+
+			if (k == all) {
+				(void)memcpy(&out[i], &vals[b], sizeof(all));
+				i += sizeof(all);
+				continue;
+			}
+
+			for (std::size_t j = b; j < b + sizeof(all); ++j) {
+				out[i] = vals[j];
+				i += keep[j];
+			}
+		}
+	}
+}
+
+/*
+ * The engine state as the words of its text form, which the standard
+ * engines print as whitespace-separated integers, and so does xoshiro256ss.
+ */
+template<typename Engine> void
+basic_ranged_random<Engine>::save(std::vector<uint8_t> &buf) const
+{
+	std::ostringstream out;
+	std::vector<uint64_t> words;
+	uint64_t w;
+
+	out << gen;
+
+	std::istringstream in(out.str());
+
+	while (in >> w) {
+		words.push_back(w);
+	}
+
+	pack_put<uint64_t>(buf, seed);
+	pack_put<uint32_t>(buf, (uint32_t)words.size());
+
+	for (auto const v : words) {
+		pack_put<uint64_t>(buf, v);
+	}
+}
+
+template<typename Engine> void
+basic_ranged_random<Engine>::load(std::vector<uint8_t> const &buf,
+	std::size_t &pos)
+{
+	std::ostringstream out;
+
+	seed = pack_get<uint64_t>(buf, pos);
+
+	for (uint32_t n = pack_get<uint32_t>(buf, pos); n > 0; --n) {
+		out << pack_get<uint64_t>(buf, pos) << ' ';
+	}
+
+	std::istringstream in(out.str());
+
+	/* all of it, or it was saved by a build with another engine */
+	if (!(in >> gen) || !(in >> std::ws).eof()) {
+		errx(1, "rng state invalid");
+	}
+}
+
+/* each lane rotated left by k, in place */
+static void
+rotl(lanes &x, int const k)
+{
+	x = (x << k) | (x >> (32 - k));
+}
+
+static uint64_t
+splitmix64(uint64_t &x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+	return z ^ (z >> 31);
+}
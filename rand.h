@@ -18,26 +18,192 @@
 #ifndef RAND_H
 #define RAND_H
 
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
 #include <random>
 #include <string>
+#include <type_traits>
+#include <vector>
 
-class ranged_random {
-	std::mt19937 gen;
+/* xoshiro256** (Blackman and Vigna): 32 bytes of state, a few cycles a draw */
+class xoshiro256ss {
+	uint64_t	s[4];
+
+	static uint64_t
+	rotl(uint64_t const x, int const k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+public:
+	using result_type = uint64_t;
+
+	xoshiro256ss();
+
+	explicit xoshiro256ss(uint64_t const);
+
+	void	seed(uint64_t const);
+	void	seed(std::seed_seq &);
+
+	static constexpr result_type
+	min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type
+	max()
+	{
+		return UINT64_MAX;
+	}
+
+	result_type
+	operator()()
+	{
+		uint64_t const res = rotl(s[1] * 5, 7) * 9;
+		uint64_t const t = s[1] << 17;
+
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+
+		return res;
+	}
+
+	friend std::ostream	&operator<<(std::ostream &,
+		xoshiro256ss const &);
+	friend std::istream	&operator>>(std::istream &, xoshiro256ss &);
+};
+
+/*
+ * What a derived stream is for. Streams of different purposes or keys are
+ * independent of each other and of the stream they were derived from, so
+ * work drawing from its own stream gives the same results whatever else
+ * drew before it, or on which thread.
+ */
+enum rand_stream : uint32_t {
+	STREAM_AI,
+	STREAM_COMBAT,
+	STREAM_FLOOR,
+	STREAM_PARSE,
+};
+
+/*
+ * Bounded draws over a uniform random bit engine. std::mt19937 keeps
+ * drawing through std::uniform_int_distribution, so its seeds lay out the
+ * same dungeons as before; other engines use Lemire's nearly divisionless
+ * method, a multiply and, rarely, a modulo.
+ */
+template<typename Engine> class basic_ranged_random {
+	Engine gen;
+
+	uint32_t
+	next32()
+	{
+		if constexpr (Engine::max() > UINT32_MAX) {
+			return (uint32_t)(gen() >> 32);
+		} else {
+			return (uint32_t)gen();
+		}
+	}
+
+	uint64_t
+	next64()
+	{
+		if constexpr (Engine::max() > UINT32_MAX) {
+			return gen();
+		} else {
+			uint64_t const hi = next32();
+
+			return hi << 32 | next32();
+		}
+	}
+
+	/* uniform in [0, range), range > 0 */
+	uint32_t
+	below32(uint32_t const range)
+	{
+		uint64_t m = (uint64_t)next32() * range;
+
+		if ((uint32_t)m < range) {
+			uint32_t const t = -range % range;
+
+			while ((uint32_t)m < t) {
+				m = (uint64_t)next32() * range;
+			}
+		}
+
+		return (uint32_t)(m >> 32);
+	}
+
+	uint64_t
+	below64(uint64_t const range)
+	{
+		__extension__ using u128 = unsigned __int128;
+
+		u128 m = (u128)next64() * range;
+
+		if ((uint64_t)m < range) {
+			uint64_t const t = -range % range;
+
+			while ((uint64_t)m < t) {
+				m = (u128)next64() * range;
+			}
+		}
+
+		return (uint64_t)(m >> 64);
+	}
 public:
 	long unsigned int seed;
 
-	ranged_random();
+	basic_ranged_random();
 
-	explicit ranged_random(std::string const &);
+	explicit basic_ranged_random(std::string const &);
 
-	explicit ranged_random(long unsigned int const);
+	explicit basic_ranged_random(long unsigned int const);
+
+	basic_ranged_random(long unsigned int const, rand_stream const,
+		uint64_t const);
+
+	/* the stream of seed for purpose p, keyed by a floor or an index */
+	basic_ranged_random
+	stream(rand_stream const p, uint64_t const key) const
+	{
+		return basic_ranged_random(seed, p, key);
+	}
+
+	void	fill(uint8_t *const, std::size_t const, uint8_t const,
+		uint8_t const);
+
+	void	save(std::vector<uint8_t> &) const;
+	void	load(std::vector<uint8_t> const &, std::size_t &);
 
 	template<typename T> T
 	rrand(T a, T b)
 	{
-		std::uniform_int_distribution<T> dis(a, b);
+		if constexpr (std::is_same_v<Engine, std::mt19937>) {
+			std::uniform_int_distribution<T> dis(a, b);
+
+			return dis(gen);
+		} else {
+			using U = std::make_unsigned_t<T>;
+
+			uint64_t const span = (U)((U)b - (U)a);
+			uint64_t off;
 
-		return dis(gen);
+			if (span < UINT32_MAX) {
+				off = below32((uint32_t)span + 1);
+			} else if (span < UINT64_MAX) {
+				off = below64(span + 1);
+			} else {
+				off = next64();
+			}
+
+			return (T)(U)((U)a + (U)off);
+		}
 	}
 
 	template<typename T> T
@@ -51,4 +217,11 @@ public:
 	}
 };
 
+/* the game's engine; build with -DRAND_MT19937 for seeds of older builds */
+#ifdef RAND_MT19937
+using ranged_random = basic_ranged_random<std::mt19937>;
+#else
+using ranged_random = basic_ranged_random<xoshiro256ss>;
+#endif
+
 #endif /* RAND_H */
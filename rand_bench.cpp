@@ -0,0 +1,99 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+#include "rand.h"
+
+/*
+ * Per-draw cost of each ranged_random backend, over the kinds of draws the
+ * game makes: small ranges (movement, placement), a wide range, dice, and
+ * whole maps of hardness.
+ */
+static std::size_t constexpr DRAWS = 1 << 24;
+
+static volatile uint64_t sink;
+
+template<typename Engine> static void	bench(char const *const);
+template<typename F> static double	per_draw(std::size_t const, F);
+
+int
+main()
+{
+	bench<std::mt19937>("mt19937");
+	bench<xoshiro256ss>("xoshiro256**");
+
+	return 0;
+}
+
+template<typename Engine> static void
+bench(char const *const name)
+{
+	basic_ranged_random<Engine> r(42);
+	std::vector<uint8_t> map(DRAWS);
+
+	(void)printf("%s\n", name);
+
+	(void)printf("  rrand<int>(-1, 1)        %6.2f ns\n",
+		per_draw(DRAWS, [&]() {
+			return (uint64_t)r.template rrand<int>(-1, 1);
+		}));
+
+	(void)printf("  rrand<uint16_t>(1, 78)   %6.2f ns\n",
+		per_draw(DRAWS, [&]() {
+			return (uint64_t)r.template rrand<uint16_t>(1, 78);
+		}));
+
+	(void)printf("  rrand<uint64_t>(0, 2^40) %6.2f ns\n",
+		per_draw(DRAWS, [&]() {
+			return r.template rrand<uint64_t>(0, 1ULL << 40);
+		}));
+
+	(void)printf("  rand_dice(0, 4, 6)       %6.2f ns\n",
+		per_draw(DRAWS / 4, [&]() {
+			return r.template rand_dice<uint64_t>(0, 4, 6);
+		}));
+
+	(void)printf("  fill(1, 254), per byte   %6.2f ns\n",
+		per_draw(1, [&]() {
+			r.fill(map.data(), map.size(), 1, 254);
+			return (uint64_t)map[DRAWS / 2];
+		}) / DRAWS);
+}
+
+/* mean ns of n calls of draw */
+template<typename F> static double
+per_draw(std::size_t const n, F draw)
+{
+	uint64_t acc = 0;
+
+	auto const start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < n; ++i) {
+		acc += draw();
+	}
+
+	auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+
+	sink = acc;
+
+	return (double)ns / (double)n;
+}
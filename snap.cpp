@@ -0,0 +1,166 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <err.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gen.h"
+#include "globs.h"
+#include "journal.h"
+#include "pack.h"
+#include "snap.h"
+#include "store.h"
+#include "turn.h"
+
+static bool	valid_header(std::vector<uint8_t> const &);
+
+/*
+ * A snapshot is the whole game as a quit or an autosave finds it, with the
+ * PC about to act: the RNG, every floor the PC has seen or that was
+ * generated ahead, and the PC with the turn queue. It is native endian,
+ * for resuming on the same machine and build.
+ */
+static char const *const FILEPATH = "/game";
+
+static char const *const MARK = "OPAL-GAME";
+static std::size_t constexpr MARK_L = 9;
+
+static uint32_t constexpr SNAP_VERSION = 5;
+
+/* marker, version, size, seed and the journal nonce */
+static std::size_t constexpr PEEK_L = MARK_L + sizeof(uint32_t)
+	+ 3 * sizeof(uint64_t);
+
+static unsigned int every;
+static unsigned int since;
+
+void
+snap_save()
+{
+	std::vector<uint8_t> buf(MARK, MARK + MARK_L);
+	std::vector<store_splice> spilled;
+
+	pack_put<uint32_t>(buf, SNAP_VERSION);
+	pack_put<uint64_t>(buf, 0);
+	pack_put<uint64_t>(buf, rr.seed);
+
+	journal_save(buf);
+	rr.save(buf);
+	level_save(buf, spilled);
+	turn_save(buf);
+
+	/* the spilled floors are read in by the store */
+	uint64_t size = buf.size();
+
+	for (auto const &sp : spilled) {
+		size += sp.size;
+	}
+
+	std::memcpy(&buf[MARK_L + sizeof(uint32_t)], &size, sizeof(size));
+
+	store_write(opal_dir() + FILEPATH, std::move(buf), std::move(spilled));
+}
+
+/* autosave every that many PC turns, none if 0 */
+void
+snap_every(unsigned int const turns)
+{
+	every = turns;
+}
+
+/* count a PC turn, telling whether an autosave is due */
+bool
+snap_due()
+{
+	if (every == 0 || ++since < every) {
+		return false;
+	}
+
+	since = 0;
+
+	return true;
+}
+
+/* in place of level_first, with the descriptions parsed */
+void
+snap_load()
+{
+	std::vector<uint8_t> buf;
+	std::size_t pos = MARK_L;
+
+	std::string const path = opal_path() + FILEPATH;
+
+	if (!store_read(path, buf, SIZE_MAX)) {
+		errx(1, "no snapshot at %s", path.c_str());
+	}
+
+	/* or of another version */
+	if (!valid_header(buf)) {
+		errx(1, "%s is not a snapshot", path.c_str());
+	}
+
+	pos += sizeof(uint32_t);
+
+	if (pack_get<uint64_t>(buf, pos) != buf.size()) {
+		errx(1, "snapshot size invalid");
+	}
+
+	/* rr was seeded with it for parsing, by snap_peek */
+	pos += sizeof(uint64_t);
+
+	journal_load(buf, pos);
+	rr.load(buf, pos);
+	level_load(buf, pos);
+	turn_load(buf, pos);
+
+	if (pos != buf.size()) {
+		errx(1, "snapshot has trailing data");
+	}
+}
+
+/* whether there is a snapshot, of which seed and of which journal */
+bool
+snap_peek(uint64_t &seed, uint64_t &nonce)
+{
+	std::vector<uint8_t> buf;
+	std::size_t pos = MARK_L + sizeof(uint32_t) + sizeof(uint64_t);
+
+	if (!store_read(opal_path() + FILEPATH, buf, PEEK_L)
+		|| !valid_header(buf)) {
+		return false;
+	}
+
+	seed = pack_get<uint64_t>(buf, pos);
+	nonce = pack_get<uint64_t>(buf, pos);
+
+	return true;
+}
+
+static bool
+valid_header(std::vector<uint8_t> const &buf)
+{
+	std::size_t pos = MARK_L;
+
+	return buf.size() >= PEEK_L
+		&& std::memcmp(buf.data(), MARK, MARK_L) == 0
+		&& pack_get<uint32_t>(buf, pos) == SNAP_VERSION;
+}
@@ -0,0 +1,141 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <optional>
+#include <vector>
+
+#include "alias.h"
+#include "globs.h"
+#include "spawn.h"
+
+/*
+ * Which description a new NPC or object comes from, in two draws. Each is
+ * weighted by 101 - rrty, so rarity 100 is the rarest and still spawns.
+ *
+ * A unique NPC or artifact is spent once spawned. Its column stays in the
+ * table and is drawn again, until the spent weight reaches half the table
+ * and it is rebuilt without them. A spawn so takes at most two tries on
+ * average, and fails only when nothing is left.
+ */
+struct spawn_table {
+	alias_table	t;
+	uint64_t	spent;
+	bool		stale = true;
+};
+
+template<typename T> static std::optional<std::size_t>
+	draw(spawn_table &, std::vector<T> &, ranged_random &);
+template<typename T> static void	build(spawn_table &,
+	std::vector<T> const &);
+
+static uint64_t	weight(dungeon_thing const &);
+static bool	unique(npc_proto const &);
+static bool	unique(obj_proto const &);
+
+/* floors are populated one at a time, on the pool or with it idle */
+static spawn_table npc_table;
+static spawn_table obj_table;
+static unsigned int rebuilds;
+
+std::optional<std::size_t>
+spawn_npc(ranged_random &r)
+{
+	return draw(npc_table, npcs_parsed, r);
+}
+
+std::optional<std::size_t>
+spawn_obj(ranged_random &r)
+{
+	return draw(obj_table, objs_parsed, r);
+}
+
+/* the spent descriptions were replaced, as by a snapshot */
+void
+spawn_reset()
+{
+	npc_table.stale = true;
+	obj_table.stale = true;
+}
+
+void
+spawn_stats(FILE *const f)
+{
+	(void)fprintf(f, "spawn tables: %zu npcs, %zu objs, %u builds\n",
+		npc_table.t.prob.size(), obj_table.t.prob.size(), rebuilds);
+}
+
+template<typename T> static std::optional<std::size_t>
+draw(spawn_table &s, std::vector<T> &protos, ranged_random &r)
+{
+	if (s.stale) {
+		build(s, protos);
+	}
+
+	if (s.t.prob.empty()) {
+		return std::nullopt;
+	}
+
+	std::size_t i;
+
+	/* the live weight is at least half of the table */
+	do {
+		i = alias_draw(s.t, r);
+	} while (protos[i].done);
+
+	if (unique(protos[i])) {
+		protos[i].done = true;
+		s.spent += weight(protos[i]);
+		s.stale = s.spent > s.t.total / 2;
+	}
+
+	return i;
+}
+
+template<typename T> static void
+build(spawn_table &s, std::vector<T> const &protos)
+{
+	std::vector<uint64_t> w(protos.size());
+
+	for (std::size_t i = 0; i < protos.size(); ++i) {
+		w[i] = protos[i].done ? 0 : weight(protos[i]);
+	}
+
+	/* empty when everything is spent */
+	(void)alias_build(s.t, w);
+
+	s.spent = 0;
+	s.stale = false;
+	rebuilds++;
+}
+
+static uint64_t
+weight(dungeon_thing const &d)
+{
+	return 101U - d.rrty;
+}
+
+static bool
+unique(npc_proto const &n)
+{
+	return n.type & UNIQ;
+}
+
+static bool
+unique(obj_proto const &o)
+{
+	return o.art;
+}
@@ -0,0 +1,34 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+
+#include "rand.h"
+
+std::optional<std::size_t>	spawn_npc(ranged_random &);
+std::optional<std::size_t>	spawn_obj(ranged_random &);
+
+void	spawn_reset();
+
+void	spawn_stats(FILE *const);
+
+#endif /* SPAWN_H */
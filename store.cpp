@@ -0,0 +1,323 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <optional>
+#include <utility>
+
+#include <ncurses.h>
+
+#include "pool.h"
+#include "store.h"
+
+/*
+ * Save files are written off the main thread. The caller serializes into a
+ * buffer and hands it over; a worker writes it to a temporary file, syncs
+ * it, and renames it over the old file. A crash at any point leaves either
+ * the old file or the new one, never a torn one.
+ *
+ * Parts of a file already in other files, as spilled floors are, can be
+ * handed over as descriptors to splice in, so that the worker reads them
+ * rather than the caller. The worker closes them.
+ *
+ * A worker must not exit with the terminal still in curses mode, so a
+ * write that fails is only recorded, and reported by the main thread once
+ * it next waits on the store.
+ */
+static void	store();
+static bool	store_file(std::string const &);
+static bool	put(int const, uint8_t const *const, std::size_t const,
+	std::string const &);
+static bool	copy(int const, store_splice const &, std::string const &);
+static bool	sync_dir(std::string const &);
+static bool	fail(char const *const, std::string const &);
+
+static std::size_t constexpr SPLICE_CHUNK = 1 << 16;
+
+static std::string path;
+static std::vector<uint8_t> data;
+static std::vector<store_splice> splices;
+static std::optional<pool_token> pending;
+
+static char const *failed;
+static std::string failed_path;
+static int failed_errno;
+
+static pool_job job_store = { "store", store, {}, {}, {} };
+
+/*
+ * Take over buf, serialized by the caller, to be written to path in the
+ * background. One write at a time, so a new one waits out the last.
+ */
+void
+store_write(std::string const &to, std::vector<uint8_t> &&buf)
+{
+	store_write(to, std::move(buf), {});
+}
+
+/* the same, with the splices in order of their offsets */
+void
+store_write(std::string const &to, std::vector<uint8_t> &&buf,
+	std::vector<store_splice> &&in)
+{
+	store_wait();
+
+	path = to;
+	data = std::move(buf);
+	splices = std::move(in);
+
+	pending.emplace(1);
+	pool_submit(job_store, *pending);
+}
+
+/* exits if the last write failed, see fail */
+void
+store_wait()
+{
+	if (pending.has_value()) {
+		pool_wait(*pending);
+		pending.reset();
+	}
+
+	if (failed == NULL) {
+		return;
+	}
+
+	if (!isendwin()) {
+		(void)endwin();
+	}
+
+	errno = failed_errno;
+	err(1, "%s %s", failed, failed_path.c_str());
+}
+
+/* up to limit bytes of path into buf, false if there is no such file */
+bool
+store_read(std::string const &from, std::vector<uint8_t> &buf,
+	std::size_t const limit)
+{
+	struct stat st;
+	std::size_t off = 0;
+	int fd;
+
+	if ((fd = open(from.c_str(), O_RDONLY)) == -1) {
+		if (errno == ENOENT) {
+			return false;
+		}
+
+		err(1, "store open %s", from.c_str());
+	}
+
+	if (fstat(fd, &st) == -1) {
+		err(1, "store fstat %s", from.c_str());
+	}
+
+	buf.resize(std::min((std::size_t)st.st_size, limit));
+
+	while (off < buf.size()) {
+		ssize_t const n = read(fd, buf.data() + off, buf.size() - off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			err(1, "store read %s", from.c_str());
+		} else if (n == 0) {
+			break;
+		}
+
+		off += (std::size_t)n;
+	}
+
+	if (close(fd) == -1) {
+		err(1, "store close %s", from.c_str());
+	}
+
+	/* shrunk since */
+	buf.resize(off);
+
+	return true;
+}
+
+void
+store_stats(FILE *const f)
+{
+	pool_print(f, job_store);
+}
+
+static void
+store()
+{
+	std::string const tmp = path + ".tmp";
+
+	if (!store_file(tmp)) {
+		(void)unlink(tmp.c_str());
+	} else if (rename(tmp.c_str(), path.c_str()) == -1) {
+		(void)fail("store rename", path);
+	} else {
+		(void)sync_dir(path);
+	}
+
+	for (auto const &sp : splices) {
+		(void)close(sp.fd);
+	}
+
+	data.clear();
+	data.shrink_to_fit();
+	splices.clear();
+}
+
+static bool
+store_file(std::string const &tmp)
+{
+	std::size_t off = 0;
+	int fd;
+
+	if ((fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600))
+		== -1) {
+		return fail("store open", tmp);
+	}
+
+	for (auto const &sp : splices) {
+		if (!put(fd, data.data() + off, sp.off - off, tmp)
+			|| !copy(fd, sp, tmp)) {
+			(void)close(fd);
+			return false;
+		}
+
+		off = sp.off;
+	}
+
+	if (!put(fd, data.data() + off, data.size() - off, tmp)) {
+		(void)close(fd);
+		return false;
+	}
+
+	if (fsync(fd) == -1) {
+		(void)fail("store fsync", tmp);
+		(void)close(fd);
+		return false;
+	}
+
+	if (close(fd) == -1) {
+		return fail("store close", tmp);
+	}
+
+	return true;
+}
+
+static bool
+put(int const fd, uint8_t const *const buf, std::size_t const len,
+	std::string const &tmp)
+{
+	std::size_t off = 0;
+
+	while (off < len) {
+		ssize_t const n = write(fd, buf + off, len - off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return fail("store write", tmp);
+		}
+
+		off += (std::size_t)n;
+	}
+
+	return true;
+}
+
+/* through a buffer, pread leaving the offset of sp.fd to its owner */
+static bool
+copy(int const fd, store_splice const &sp, std::string const &tmp)
+{
+	std::vector<uint8_t> buf(std::min(sp.size, SPLICE_CHUNK));
+	std::size_t off = 0;
+
+	while (off < sp.size) {
+		ssize_t const n = pread(sp.fd, buf.data(),
+			std::min(buf.size(), sp.size - off), (off_t)off);
+
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return fail("store pread", tmp);
+		}
+
+		/* the source shrank */
+		if (n == 0) {
+			errno = EIO;
+			return fail("store pread", tmp);
+		}
+
+		if (!put(fd, buf.data(), (std::size_t)n, tmp)) {
+			return false;
+		}
+
+		off += (std::size_t)n;
+	}
+
+	return true;
+}
+
+/* make the rename itself durable */
+static bool
+sync_dir(std::string const &file)
+{
+	std::string const dir = file.substr(0, file.find_last_of('/'));
+	int fd;
+
+	if ((fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY)) == -1) {
+		return fail("store open", dir);
+	}
+
+	if (fsync(fd) == -1) {
+		(void)fail("store fsync", dir);
+		(void)close(fd);
+		return false;
+	}
+
+	if (close(fd) == -1) {
+		return fail("store close", dir);
+	}
+
+	return true;
+}
+
+/* keep what failed, with errno, for store_wait to report */
+static bool
+fail(char const *const what, std::string const &file)
+{
+	failed_errno = errno;
+	failed = what;
+	failed_path = file;
+
+	return false;
+}
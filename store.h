@@ -0,0 +1,44 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef STORE_H
+#define STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* size bytes of fd, written in at off of a buffer handed to store_write */
+struct store_splice {
+	std::size_t	off;
+	int		fd;
+	std::size_t	size;
+};
+
+void	store_write(std::string const &, std::vector<uint8_t> &&);
+void	store_write(std::string const &, std::vector<uint8_t> &&,
+	std::vector<store_splice> &&);
+void	store_wait();
+
+bool	store_read(std::string const &, std::vector<uint8_t> &,
+	std::size_t const);
+
+void	store_stats(FILE *const);
+
+#endif /* STORE_H */
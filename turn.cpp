@@ -16,11 +16,9 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include <algorithm>
+#include <array>
 #include <cinttypes>
-#include <functional>
 #include <limits>
-#include <new>
-#include <queue>
 #include <sstream>
 #include <tuple>
 #include <utility>
@@ -28,34 +26,34 @@
 
 #include <err.h>
 
+#include "dice.h"
 #include "dijk.h"
 #include "globs.h"
+#include "journal.h"
+#include "pack.h"
+#include "snap.h"
 #include "turn.h"
+#include "wheel.h"
 
-static bool	valid_thing(uint8_t const, uint8_t const);
-
-static double		distance(uint8_t const, uint8_t const, uint8_t const, uint8_t const);
+static double		distance(uint16_t const, uint16_t const, uint16_t const, uint16_t const);
 static unsigned int	subu32(unsigned int const, unsigned int const);
 static uint64_t		subu64(uint64_t const, uint64_t const);
 
 static bool	pc_visible(int const, int const);
 
-static void	npc_obj_or_tile(WINDOW *const, uint8_t const, uint8_t const);
+static void	npc_obj_or_tile(WINDOW *const, uint16_t const, uint16_t const);
 
 static uint64_t	effective_dam();
 static uint64_t	combat(npc &, npc &);
 
-static void	move_redraw(WINDOW *const, npc &, uint8_t const, uint8_t const);
-static void	move_logic(WINDOW *const, npc &, uint8_t const, uint8_t const);
-static void	move_tunnel(WINDOW *const, npc &, uint8_t const, uint8_t const);
+static void	move_redraw(WINDOW *const, npc &, uint16_t const, uint16_t const);
+static void	move_logic(WINDOW *const, npc &, uint16_t const, uint16_t const);
+static void	move_tunnel(WINDOW *const, npc &, uint16_t const, uint16_t const);
 
 static void	move_straight(WINDOW *const, npc &);
 static void	move_dijk_nontunneling(WINDOW *const, npc &);
 static void	move_dijk_tunneling(WINDOW *const, npc &);
 
-static std::optional<std::pair<uint8_t, uint8_t>>	gen_npc();
-static std::optional<std::pair<uint8_t, uint8_t>>	gen_obj();
-
 static void	npc_list(WINDOW *const, std::vector<npc *> const &);
 
 #ifdef DEBUG
@@ -65,12 +63,14 @@ static bool	inspect(WINDOW *const, bool const);
 static bool	inspect(WINDOW *const);
 #endif
 
-static void	crosshair(WINDOW *const, uint8_t const, uint8_t const);
+static void	crosshair(WINDOW *const, int const, int const);
+
+static void	view(WINDOW *const, WINDOW *const, int const, int const);
 
 static bool	viewable(int const, int const);
 static void	pc_viewbox(WINDOW *const, int const);
 
-static void	try_carry(uint8_t const, uint8_t const);
+static void	try_carry(uint16_t const, uint16_t const);
 
 static void	equip_list(WINDOW *const, bool const);
 
@@ -79,6 +79,14 @@ static void	equip_to_carry(int const, std::optional<std::string> &);
 
 static void	swap(std::optional<obj> &, std::optional<obj> &);
 
+static void	redraw_visited(WINDOW *const);
+
+static std::array<std::optional<obj> *, 12>	equip_slots();
+static void	save_item(std::vector<uint8_t> &,
+	std::optional<obj> const &);
+static void	load_item(std::vector<uint8_t> const &, std::size_t &,
+	std::optional<obj> &);
+
 static void	thing_details(WINDOW *const, dungeon_thing const &);
 
 enum pc_action {
@@ -86,11 +94,12 @@ enum pc_action {
 	PC_DEFOG,
 	PC_TELE,
 #endif
-	PC_NEXT,
+	PC_DN,
 	PC_NONE,
 	PC_NPC_LIST,
 	PC_QUIT,
-	PC_RETRY
+	PC_RETRY,
+	PC_UP
 };
 
 static enum pc_action	turn_npc(WINDOW *const, WINDOW *const, npc &);
@@ -165,143 +174,113 @@ static bool type_map_equip[] = {
 	true
 };
 
-struct compare_npc {
-	bool constexpr
-	operator() (npc const &x, npc const &y) const
-	{
-		return x.turn > y.turn;
-	}
-};
-
-/* minimum distance from the PC an NPC can be placed */
-static double constexpr CUTOFF = 4.0;
 static int constexpr PERSISTANCE = 5;
 static int constexpr KEY_ESC = 27;
 static int constexpr DEFAULT_LUMINANCE = 5;
-static unsigned int constexpr RETRIES = 300;
 static int constexpr PC_CARRY_MAX = 10;
 static uint64_t constexpr HEAL_CAP = 500;
 
 static std::optional<obj> pc_carry[PC_CARRY_MAX];
 static equip pc_equip;
 
+/*
+ * The whole floor is drawn to a pad at map coordinates. The screen shows a
+ * viewport of it inside the box, with view_y and view_x the map coordinates
+ * of its top left tile.
+ */
+static WINDOW *pad;
+static int view_y;
+static int view_x;
+
+/*
+ * The actors waiting for their turn. The slain leave it as they fall, and
+ * a fallen boss ends the game once the turn that slew it is over.
+ */
+static turn_wheel wheel;
+static bool boss_slain;
+
+/*
+ * The queue as turn_engine left it, in turn order without the PC. After a
+ * restored quit it resumes from there, the PC still holding its turn.
+ */
+static std::vector<npc *> queued;
+static bool resume;
+
+/* NPC movement and combat draw apart, see turn_seed */
+static ranged_random ai;
+static ranged_random fight;
+
 enum turn_exit
-turn_engine(WINDOW *const win, unsigned int const numnpcs,
-	unsigned int const numobjs)
+turn_engine(WINDOW *const win)
 {
-	std::priority_queue<npc, std::vector<std::reference_wrapper<npc>>, compare_npc> heap;
-	std::vector<npc *> npcs;
-	std::vector<obj *> objs;
-	unsigned int real_num = 0;
+	std::vector<npc *> &npcs = cur_level.npcs;
 	size_t bosses = 0;
+	bool smart_d = false;
+	bool smart_dt = false;
 
 	WINDOW *sep;
 
 	uint64_t turn;
 	enum turn_exit ret = TURN_NONE;
 
-	try {
-		npcs.resize(numnpcs);
-		objs.resize(numobjs);
-	} catch (std::bad_alloc const &) {
-		err(1, "resize npcs and objs");
+	if ((pad = newpad(tiles.height, tiles.width)) == NULL) {
+		errx(1, "newpad");
 	}
 
-	tiles[player.y][player.x].n = &player;
-
-	wattron(win, player.color);
-	(void)mvwaddch(win, player.y, player.x, player.symb);
-	wattroff(win, player.color);
-
-	heap.push(player);
-
-	for (auto &n : npcs) {
-		size_t i;
-		unsigned int retries = 0;
-		do {
-			i = rr.rrand<size_t>(0, npcs_parsed.size() - 1);
-			retries++;
-		} while (retries < RETRIES && (npcs_parsed[i].done
-			|| npcs_parsed[i].rrty >= rr.rrand<uint8_t>(0, 99)));
+	tiles.n(player.y, player.x) = &player;
 
-		if (retries == RETRIES) {
-			break;
-		}
+	redraw_visited(pad);
 
-		std::optional<std::pair<uint8_t, uint8_t>> coords = gen_npc();
+	wattron(pad, player.proto->color);
+	(void)mvwaddch(pad, player.y, player.x, player.proto->symb);
+	wattroff(pad, player.proto->color);
 
-		if (!coords.has_value()) {
-			break;
+	/* spawned with the floor */
+	for (auto const n : npcs) {
+		if (n->proto->type & BOSS) {
+			bosses++;
 		}
 
-		real_num++;
-
-		n = new npc(npcs_parsed[i]);
-
-		if (n->type & UNIQ) {
-			n->done = true;
-			npcs_parsed[i].done = true;
+		if (n->dead || !(n->proto->type & SMART)) {
+			continue;
 		}
 
-		if (n->type & BOSS) {
-			bosses++;
+		if (n->proto->type & TUNNEL) {
+			smart_dt = true;
+		} else {
+			smart_d = true;
 		}
-
-		n->x = coords->first;
-		n->y = coords->second;
-		n->turn = 1;
-
-		tiles[n->y][n->x].n = n;
-
-		heap.push(*n);
 	}
 
-	if (real_num != numnpcs) {
-		npcs.resize(real_num);
-	}
+	dijkstra_want(smart_d, smart_dt);
 
-	real_num = 0;
+	boss_slain = false;
 
-	for (auto &o : objs) {
-		size_t i = 0;
-		unsigned int retries = 0;
-		do {
-			i = rr.rrand<size_t>(0, objs_parsed.size() - 1);
-			retries++;
-		} while (retries < RETRIES && (objs_parsed[i].done
-			|| objs_parsed[i].rrty >= rr.rrand<uint8_t>(0, 99)));
+	/* ties go in the order scheduled */
+	if (resume) {
+		/* the PC acts first, though its next turn is already set */
+		uint64_t first = player.turn;
 
-		if (retries == RETRIES) {
-			break;
+		for (auto const n : queued) {
+			first = std::min(first, n->turn);
 		}
 
-		std::optional<std::pair<uint8_t, uint8_t>> coords = gen_obj();
+		wheel.reset(first);
 
-		if (!coords.has_value()) {
-			break;
+		for (auto const n : queued) {
+			wheel.schedule(*n);
 		}
+	} else {
+		wheel.reset(player.turn);
+		wheel.schedule(player);
 
-		real_num++;
-
-		o = new obj(objs_parsed[i]);
-
-		if (o->art) {
-			o->done = true;
-			objs_parsed[i].done = true;
+		for (auto const n : npcs) {
+			if (!n->dead) {
+				wheel.schedule(*n);
+			}
 		}
-
-		o->x = coords->first;
-		o->y = coords->second;
-
-		tiles[o->y][o->x].o = o;
-	}
-
-	if (real_num != numobjs) {
-		objs.resize(real_num);
 	}
 
-	dijkstra();
-
 	if ((sep = newwin(HEIGHT, WIDTH, 0, 0)) == NULL) {
 		errx(1, "newwin sep");
 	}
@@ -324,34 +303,33 @@ turn_engine(WINDOW *const win, unsigned int const numnpcs,
 		wattroff(win, COLOR_PAIR(COLOR_RED));
 	}
 
-	pc_viewbox(win, DEFAULT_LUMINANCE);
+	pc_viewbox(pad, DEFAULT_LUMINANCE);
 
 	(void)mvwprintw(win, HEIGHT - 1, 2,
 		"[ hp: %" PRIu64 "; speed: %" PRIu64 " ]", player.hp,
 			player.speed);
 
-	while (!heap.empty()) {
-		npc &n = heap.top();
-		heap.pop();
+	while (resume || wheel.size != 0) {
+		npc &n = resume ? player : wheel.next();
 
-		if (n.type & PLAYER_TYPE && wrefresh(win) == ERR) {
+		/* played back keys are not shown */
+		if (n.proto->type & PLAYER_TYPE && !journal_replaying()
+			&& wrefresh(win) == ERR) {
 			errx(1, "turn_engine wrefresh");
 		}
 
-		if (n.hp == 0) {
-			if (n.type & PLAYER_TYPE) {
-				ret = TURN_DEATH;
-				goto exit;
-			} else if (n.type & BOSS) {
-				ret = TURN_WIN;
-				goto exit;
-			} else {
-				continue;
-			}
+		if (resume) {
+			resume = false;
+		} else {
+			turn = n.turn + 1;
+			n.turn = turn + 1000/n.speed;
 		}
 
-		turn = n.turn + 1;
-		n.turn = turn + 1000/n.speed;
+		/* as a quit would leave the game, so -r resumes here */
+		if (n.proto->type & PLAYER_TYPE && snap_due()) {
+			wheel.pending(queued);
+			snap_save();
+		}
 
 		retry:
 		if (touchwin(win) == ERR) {
@@ -370,8 +348,8 @@ turn_engine(WINDOW *const win, unsigned int const numnpcs,
 				goto retry;
 			}
 #endif
-		case PC_NEXT:
-			ret = TURN_NEXT;
+		case PC_DN:
+			ret = TURN_DN;
 			goto exit;
 		case PC_NONE:
 			break;
@@ -383,40 +361,115 @@ turn_engine(WINDOW *const win, unsigned int const numnpcs,
 			goto exit;
 		case PC_RETRY:
 			goto retry;
+		case PC_UP:
+			ret = TURN_UP;
+			goto exit;
 		}
 
-		heap.push(n);
-	}
+		if (player.hp == 0) {
+			ret = TURN_DEATH;
+			goto exit;
+		}
 
-	exit:
+		if (boss_slain) {
+			ret = TURN_WIN;
+			goto exit;
+		}
 
-	for (auto &n : npcs) {
-		delete n;
+		wheel.schedule(n);
 	}
 
-	for (auto &o : objs) {
-		delete o;
-	}
+	exit:
 
+	wheel.pending(queued);
+
+	/* the floor keeps its NPCs and objects, see level_next */
 	if (delwin(sep) == ERR) {
 		errx(1, "turn_engine delwin sep");
 	}
 
+	if (delwin(pad) == ERR) {
+		errx(1, "turn_engine delwin pad");
+	}
+
 	return ret;
 }
 
-static bool
-valid_thing(uint8_t const y, uint8_t const x)
+/* a new game, once rr is seeded */
+void
+turn_seed()
 {
-	if (tiles[y][x].h != 0) {
-		return false;
+	ai = rr.stream(STREAM_AI, 0);
+	fight = rr.stream(STREAM_COMBAT, 0);
+}
+
+/* the PC and its queue, once turn_engine returned from a quit */
+void
+turn_save(std::vector<uint8_t> &buf)
+{
+	std::vector<npc *> const &npcs = cur_level.npcs;
+
+	pack_put<uint64_t>(buf, player.hp);
+	pack_put<uint64_t>(buf, player.speed);
+	pack_put<uint64_t>(buf, player.turn);
+
+	ai.save(buf);
+	fight.save(buf);
+
+	for (auto const &o : pc_carry) {
+		save_item(buf, o);
 	}
 
-	return distance(player.x, player.y, x, y) > CUTOFF;
+	for (auto const o : equip_slots()) {
+		save_item(buf, *o);
+	}
+
+	pack_put<uint32_t>(buf, (uint32_t)queued.size());
+
+	for (auto const n : queued) {
+		pack_put<uint32_t>(buf, (uint32_t)(std::find(npcs.begin(),
+			npcs.end(), n) - npcs.begin()));
+	}
+}
+
+/* requires the floor in play restored */
+void
+turn_load(std::vector<uint8_t> const &buf, std::size_t &pos)
+{
+	std::vector<npc *> const &npcs = cur_level.npcs;
+
+	player.hp = pack_get<uint64_t>(buf, pos);
+	player.speed = pack_get<uint64_t>(buf, pos);
+	player.turn = pack_get<uint64_t>(buf, pos);
+
+	ai.load(buf, pos);
+	fight.load(buf, pos);
+
+	for (auto &o : pc_carry) {
+		load_item(buf, pos, o);
+	}
+
+	for (auto const o : equip_slots()) {
+		load_item(buf, pos, *o);
+	}
+
+	queued.resize(pack_get<uint32_t>(buf, pos));
+
+	for (auto &n : queued) {
+		uint32_t const i = pack_get<uint32_t>(buf, pos);
+
+		if (i >= npcs.size()) {
+			errx(1, "snapshot turn queue invalid");
+		}
+
+		n = npcs[i];
+	}
+
+	resume = true;
 }
 
 static double
-distance(uint8_t const x0, uint8_t const y0, uint8_t const x1, uint8_t const y1)
+distance(uint16_t const x0, uint16_t const y0, uint16_t const x1, uint16_t const y1)
 {
 	int const dx = x1 - x0;
 	int const dy = y1 - y0;
@@ -458,7 +511,7 @@ pc_visible(int const x1, int const y1)
 	int err = (dx > dy ? dx : -dy) / 2;
 
 	while (1) {
-		if (tiles[y0][x0].h != 0) {
+		if (!tiles.open(y0, x0)) {
 			return false;
 		}
 
@@ -483,47 +536,29 @@ pc_visible(int const x1, int const y1)
 }
 
 static void
-npc_obj_or_tile(WINDOW *const win, uint8_t const y, uint8_t const x)
+npc_obj_or_tile(WINDOW *const win, uint16_t const y, uint16_t const x)
 {
-	if (tiles[y][x].n != NULL) {
-		wattron(win, tiles[y][x].n->color);
-		(void)mvwaddch(win, y, x, tiles[y][x].n->symb);
-		wattroff(win, tiles[y][x].n->color);
-	} else if (tiles[y][x].o != NULL) {
-		wattron(win, tiles[y][x].o->color);
-		(void)mvwaddch(win, y, x, tiles[y][x].o->symb);
-		wattroff(win, tiles[y][x].o->color);
+	if (tiles.n(y, x) != NULL) {
+		wattron(win, tiles.n(y, x)->proto->color);
+		(void)mvwaddch(win, y, x, tiles.n(y, x)->proto->symb);
+		wattroff(win, tiles.n(y, x)->proto->color);
+	} else if (tiles.o(y, x) != NULL) {
+		wattron(win, tiles.o(y, x)->proto->color);
+		(void)mvwaddch(win, y, x, tiles.o(y, x)->proto->symb);
+		wattroff(win, tiles.o(y, x)->proto->color);
 	} else {
-		(void)mvwaddch(win, y, x, tiles[y][x].c);
+		(void)mvwaddch(win, y, x, tiles.c(y, x));
 	}
 }
 
 static uint64_t
 effective_dam()
 {
-	int const length = 12;
-	std::optional<obj> const equip[] = {
-		pc_equip.amulet,
-		pc_equip.armor,
-		pc_equip.boots,
-		pc_equip.cloak,
-		pc_equip.gloves,
-		pc_equip.helmet,
-		pc_equip.light,
-		pc_equip.offhand,
-		pc_equip.ranged,
-		pc_equip.ring_left,
-		pc_equip.ring_right,
-		pc_equip.weapon
-	};
+	uint64_t dam = dice_roll(fight, player.proto->dam);
 
-	uint64_t dam = rr.rand_dice<uint64_t>(player.dam.base, player.dam.dice,
-		player.dam.sides);
-
-	for (int i = 0; i < length; ++i) {
-		if (equip[i].has_value()) {
-			dam += rr.rand_dice<uint64_t>(equip[i]->dam.base,
-				equip[i]->dam.dice, equip[i]->dam.sides);
+	for (auto const o : equip_slots()) {
+		if (o->has_value()) {
+			dam += dice_roll(fight, (*o)->proto->dam);
 		}
 	}
 
@@ -533,11 +568,10 @@ effective_dam()
 static uint64_t
 combat(npc &n1, npc &n2)
 {
-	uint64_t n1_dam = rr.rand_dice<uint64_t>(n1.dam.base, n1.dam.dice,
-		n1.dam.sides);
+	uint64_t n1_dam = dice_roll(fight, n1.proto->dam);
 	uint64_t n2_hp = n2.hp;
 
-	if (n1.type & PLAYER_TYPE) {
+	if (n1.proto->type & PLAYER_TYPE) {
 		n1_dam = effective_dam();
 	} else {
 		n2_hp = player.hp;
@@ -549,19 +583,19 @@ combat(npc &n1, npc &n2)
 }
 
 static void
-move_redraw(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
+move_redraw(WINDOW *const win, npc &n, uint16_t const y, uint16_t const x)
 {
-	tiles[n.y][n.x].n = NULL;
-	tiles[y][x].n = &n;
+	tiles.n(n.y, n.x) = NULL;
+	tiles.n(y, x) = &n;
 
-	if (tiles[n.y][n.x].v || n.type & PLAYER_TYPE) {
+	if (tiles.v(n.y, n.x) || n.proto->type & PLAYER_TYPE) {
 		npc_obj_or_tile(win, n.y, n.x);
 	}
 
-	if (tiles[y][x].v) {
-		wattron(win, n.color);
-		(void)mvwaddch(win, y, x, n.symb);
-		wattroff(win, n.color);
+	if (tiles.v(y, x)) {
+		wattron(win, n.proto->color);
+		(void)mvwaddch(win, y, x, n.proto->symb);
+		wattroff(win, n.proto->color);
 	}
 
 	n.y = y;
@@ -569,28 +603,29 @@ move_redraw(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
 }
 
 static void
-move_logic(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
+move_logic(WINDOW *const win, npc &n, uint16_t const y, uint16_t const x)
 {
 	if (n.y == y && n.x == x) {
 		return;
 	}
 
 	/* move to empty tile */
-	if (tiles[y][x].n == NULL) {
-		move_redraw(win, n, y, x);
+	if (tiles.n(y, x) == NULL) {
+		move_redraw(pad, n, y, x);
 		return;
 	}
 
 	/* npc-pc combat */
-	if (n.type & PLAYER_TYPE || tiles[y][x].n->type & PLAYER_TYPE) {
-		uint64_t dam = combat(n, *tiles[y][x].n);
+	if (n.proto->type & PLAYER_TYPE
+		|| tiles.n(y, x)->proto->type & PLAYER_TYPE) {
+		uint64_t dam = combat(n, *tiles.n(y, x));
 
 		(void)box(win, 0, 0);
 		(void)mvwprintw(win, HEIGHT - 1, 2,
 			"[ hp: %" PRIu64 "; speed: %" PRIu64 " ]", player.hp,
 				player.speed);
 
-		if (n.type & PLAYER_TYPE) {
+		if (n.proto->type & PLAYER_TYPE) {
 			(void)mvwprintw(win, HEIGHT - 1, WIDTH / 2,
 				"[ delt %" PRIu64 " damage ]", dam);
 		} else {
@@ -598,16 +633,22 @@ move_logic(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
 				"[ received %" PRIu64 " damage ]", dam);
 		}
 
-		if (tiles[y][x].n->hp == 0) {
+		if (tiles.n(y, x)->hp == 0) {
 			if (n.hp > HEAL_CAP) {
 				n.hp += 5;
 			} else {
 				dam++;
-				n.hp += rr.rrand<uint64_t>(dam/2, dam);
+				n.hp += fight.rrand<uint64_t>(dam/2, dam);
+			}
+
+			if (tiles.n(y, x)->proto->type & BOSS) {
+				boss_slain = true;
 			}
-			tiles[y][x].n->dead = true;
-			tiles[y][x].n = NULL;
-			npc_obj_or_tile(win, y, x);
+
+			tiles.n(y, x)->dead = true;
+			wheel.cancel(*tiles.n(y, x));
+			tiles.n(y, x) = NULL;
+			npc_obj_or_tile(pad, y, x);
 		}
 
 		return;
@@ -616,45 +657,48 @@ move_logic(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
 	/* npc-to-npc */
 	for (int i = -1; i <= 1; ++i) {
 		for (int j = -1; j <= 1; ++j) {
-			uint8_t tx = (uint8_t)(tiles[y][x].n->x + i);
-			uint8_t ty = (uint8_t)(tiles[y][x].n->y + j);
+			uint16_t tx = (uint16_t)(tiles.n(y, x)->x + i);
+			uint16_t ty = (uint16_t)(tiles.n(y, x)->y + j);
 
-			if (tx == 0 || ty == 0 || tx >= WIDTH - 1
-				|| ty >= HEIGHT - 1) {
+			if (tx == 0 || ty == 0 || tx >= tiles.width - 1
+				|| ty >= tiles.height - 1) {
 				continue;
 			}
 
-			if (tiles[ty][tx].n == NULL && tiles[ty][tx].h == 0) {
-				/* move to tiles[y][x].n to ty, tx */
-				move_redraw(win, *tiles[y][x].n, ty, tx);
-				move_redraw(win, n, y, x);
+			if (tiles.n(ty, tx) == NULL && tiles.open(ty, tx)) {
+				/* move to tiles.n(y, x) to ty, tx */
+				move_redraw(pad, *tiles.n(y, x), ty, tx);
+				move_redraw(pad, n, y, x);
 				return;
 			}
 		}
 	}
 
-	/* swap tiles[y][x].n with n */
-	move_redraw(win, *tiles[y][x].n, n.y, n.x);
-	move_redraw(win, n, y, x);
+	/* swap tiles.n(y, x) with n */
+	move_redraw(pad, *tiles.n(y, x), n.y, n.x);
+	move_redraw(pad, n, y, x);
 }
 
 static void
-move_tunnel(WINDOW *const win, npc &n, uint8_t const y, uint8_t const x)
+move_tunnel(WINDOW *const win, npc &n, uint16_t const y, uint16_t const x)
 {
-	if (tiles[y][x].h == UINT8_MAX) {
+	if (tiles.h(y, x) == UINT8_MAX) {
 		return;
 	}
 
-	tiles[y][x].h = (uint8_t)subu32(tiles[y][x].h, TUNNEL_STRENGTH);
+	uint8_t const h = tiles.h(y, x);
+	tiles.set_h(y, x, (uint8_t)subu32(h, TUNNEL_STRENGTH));
 
-	dijkstra();
+	if (tiles.h(y, x) != h) {
+		dijkstra_repair(y, x);
+	}
 
-	if (tiles[y][x].h != 0) {
+	if (!tiles.open(y, x)) {
 		return;
 	}
 
-	if (tiles[y][x].c == ROCK) {
-		tiles[y][x].c = CORRIDOR;
+	if (tiles.c(y, x) == ROCK) {
+		tiles.c(y, x) = CORRIDOR;
 	}
 
 	move_logic(win, n, y, x);
@@ -664,15 +708,15 @@ static void
 move_straight(WINDOW *const win, npc &n)
 {
 	double min = std::numeric_limits<double>::max();
-	uint8_t minx = n.x;
-	uint8_t miny = n.y;
+	uint16_t minx = n.x;
+	uint16_t miny = n.y;
 
 	for (int i = -1; i <= 1; ++i) {
 		for (int j = -1; j <= 1; ++j) {
-			uint8_t x = (uint8_t)(n.x + i);
-			uint8_t y = (uint8_t)(n.y + j);
+			uint16_t x = (uint16_t)(n.x + i);
+			uint16_t y = (uint16_t)(n.y + j);
 
-			if (!(n.type & TUNNEL) && tiles[y][x].h != 0) {
+			if (!(n.proto->type & TUNNEL) && !tiles.open(y, x)) {
 				continue;
 			}
 
@@ -686,7 +730,7 @@ move_straight(WINDOW *const win, npc &n)
 		}
 	}
 
-	if (n.type & TUNNEL) {
+	if (n.proto->type & TUNNEL) {
 		move_tunnel(win, n, miny, minx);
 	} else {
 		move_logic(win, n, miny, minx);
@@ -696,22 +740,24 @@ move_straight(WINDOW *const win, npc &n)
 static void
 move_dijk_nontunneling(WINDOW *const win, npc &n)
 {
-	int32_t min_d = tiles[n.y][n.x].d;
-	uint8_t minx = n.x;
-	uint8_t miny = n.y;
+	dijkstra_ensure_d();
+
+	int32_t min_d = tiles.d(n.y, n.x);
+	uint16_t minx = n.x;
+	uint16_t miny = n.y;
 
 	for (int i = -1; i <= 1; ++i) {
 		for (int j = -1; j <= 1; ++j) {
-			uint8_t x = (uint8_t)(n.x + i);
-			uint8_t y = (uint8_t)(n.y + j);
+			uint16_t x = (uint16_t)(n.x + i);
+			uint16_t y = (uint16_t)(n.y + j);
 
 
-			if (tiles[y][x].h != 0) {
+			if (!tiles.open(y, x)) {
 				continue;
 			}
 
-			if (tiles[y][x].d < min_d) {
-				min_d = tiles[y][x].d;
+			if (tiles.d(y, x) < min_d) {
+				min_d = tiles.d(y, x);
 				minx = x;
 				miny = y;
 			}
@@ -724,17 +770,19 @@ move_dijk_nontunneling(WINDOW *const win, npc &n)
 static void
 move_dijk_tunneling(WINDOW *const win, npc &n)
 {
-	int32_t min_dt = tiles[n.y][n.x].dt;
-	uint8_t minx = n.x;
-	uint8_t miny = n.y;
+	dijkstra_ensure_dt();
+
+	int32_t min_dt = tiles.dt(n.y, n.x);
+	uint16_t minx = n.x;
+	uint16_t miny = n.y;
 
 	for (int i = -1; i <= 1; ++i) {
 		for (int j = -1; j <= 1; ++j) {
-			uint8_t x = (uint8_t)(n.x + i);
-			uint8_t y = (uint8_t)(n.y + j);
+			uint16_t x = (uint16_t)(n.x + i);
+			uint16_t y = (uint16_t)(n.y + j);
 
-			if (tiles[y][x].dt < min_dt) {
-				min_dt = tiles[y][x].dt;
+			if (tiles.dt(y, x) < min_dt) {
+				min_dt = tiles.dt(y, x);
 				minx = x;
 				miny = y;
 			}
@@ -744,63 +792,23 @@ move_dijk_tunneling(WINDOW *const win, npc &n)
 	move_tunnel(win, n, miny, minx);
 }
 
-static std::optional<std::pair<uint8_t, uint8_t>>
-gen_npc()
-{
-	uint8_t x, y;
-	size_t retries = 0;
-
-	do {
-		x = rr.rrand<uint8_t>(1, WIDTH - 2);
-		y = rr.rrand<uint8_t>(1, HEIGHT - 2);
-		retries++;
-	} while (retries < RETRIES && (!valid_thing(y, x)
-		|| tiles[y][x].n != NULL));
-
-	if (retries == RETRIES) {
-		return {};
-	}
-
-	return std::make_pair(x, y);
-}
-
-static std::optional<std::pair<uint8_t, uint8_t>>
-gen_obj()
-{
-	uint8_t x, y;
-	size_t retries = 0;
-
-	do {
-		x = rr.rrand<uint8_t>(1, WIDTH - 2);
-		y = rr.rrand<uint8_t>(1, HEIGHT - 2);
-		retries++;
-	} while (retries < RETRIES && (!valid_thing(y, x)
-		|| tiles[y][x].o != NULL));
-
-	if (retries == RETRIES) {
-		return {};
-	}
-
-	return std::make_pair(x, y);
-}
-
 static enum pc_action
 turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 {
-	if (n.type & PLAYER_TYPE) {
-		pc_viewbox(win, DEFAULT_LUMINANCE);
+	if (n.proto->type & PLAYER_TYPE) {
+		pc_viewbox(pad, DEFAULT_LUMINANCE);
 		return turn_pc(win, sep, n);
 	}
 
-	if (n.type & ERRATIC && rr.rrand<int>(0, 1) == 0) {
-		uint8_t y, x;
+	if (n.proto->type & ERRATIC && ai.rrand<int>(0, 1) == 0) {
+		uint16_t y, x;
 
 		do {
-			y = (uint8_t)(n.y + rr.rrand<int>(-1, 1));
-			x = (uint8_t)(n.x + rr.rrand<int>(-1, 1));
-		} while (!(n.type & TUNNEL) && tiles[y][x].h != 0);
+			y = (uint16_t)(n.y + ai.rrand<int>(-1, 1));
+			x = (uint16_t)(n.x + ai.rrand<int>(-1, 1));
+		} while (!(n.proto->type & TUNNEL) && !tiles.open(y, x));
 
-		if (n.type & TUNNEL) {
+		if (n.proto->type & TUNNEL) {
 			move_tunnel(win, n, y, x);
 		} else {
 			move_logic(win, n, y, x);
@@ -809,7 +817,7 @@ turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 		return PC_NONE;
 	}
 
-	uint16_t const basic_type = n.type & 0xF;
+	uint16_t const basic_type = n.proto->type & 0xF;
 
 	switch(basic_type) {
 	case 0x0:
@@ -833,7 +841,7 @@ turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 	case 0x3:
 	case 0xB:
 		/* nontunneling dijk, remembered location or telepathic */
-		if (n.type & TELE || pc_visible(n.x, n.y)) {
+		if (n.proto->type & TELE || pc_visible(n.x, n.y)) {
 			n.p_count = PERSISTANCE;
 		}
 
@@ -847,7 +855,7 @@ turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 	case 0x7:
 	case 0xF:
 		/* tunneling dijk, remembered location or telepathic */
-		if (n.type & TELE || pc_visible(n.x, n.y)) {
+		if (n.proto->type & TELE || pc_visible(n.x, n.y)) {
 			n.p_count = PERSISTANCE;
 		}
 
@@ -857,7 +865,7 @@ turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 		}
 		break;
 	default:
-		errx(1, "turn_npc invalid npc type %d", n.type);
+		errx(1, "turn_npc invalid npc type %d", n.proto->type);
 	}
 
 	return PC_NONE;
@@ -866,17 +874,21 @@ turn_npc(WINDOW *const win, WINDOW *const sep, npc &n)
 static enum pc_action
 turn_pc(WINDOW *const win, WINDOW *const sep, npc &n)
 {
-	uint8_t y = n.y;
-	uint8_t x = n.x;
+	uint16_t const py = n.y;
+	uint16_t const px = n.x;
+	uint16_t y = n.y;
+	uint16_t x = n.x;
 	bool exit = false;
 
 	(void)mvwprintw(win, HEIGHT - 1, 2,
 		"[ hp: %" PRIu64 "; speed: %" PRIu64 " ]", player.hp,
 			player.speed);
 
+	view(win, pad, player.y, player.x);
+
 	while (!exit) {
 		exit = true;
-		switch(wgetch(win)) {
+		switch(journal_key(win)) {
 		case ERR:
 			errx(1, "turn_pc wgetch ERR");
 			break;
@@ -945,16 +957,16 @@ turn_pc(WINDOW *const win, WINDOW *const sep, npc &n)
 			break;
 		case '>':
 			/* go down stairs */
-			if (tiles[y][x].c == STAIR_DN) {
-				return PC_NEXT;
+			if (tiles.c(y, x) == STAIR_DN) {
+				return PC_DN;
 			} else {
 				exit = false;
 			}
 			break;
 		case '<':
 			/* go up stairs */
-			if (tiles[y][x].c == STAIR_UP) {
-				return PC_NEXT;
+			if (tiles.c(y, x) == STAIR_UP) {
+				return PC_UP;
 			} else {
 				exit = false;
 			}
@@ -1003,10 +1015,14 @@ turn_pc(WINDOW *const win, WINDOW *const sep, npc &n)
 		}
 	}
 
-	if (tiles[y][x].h == 0) {
+	if (tiles.open(y, x)) {
 		move_logic(win, n, y, x);
 		try_carry(y, x);
-		dijkstra();
+
+		/* resting or attacking leaves the maps valid */
+		if (n.y != py || n.x != px) {
+			dijkstra_invalidate();
+		}
 	}
 
 	return PC_NONE;
@@ -1033,8 +1049,10 @@ npc_list(WINDOW *const nwin, std::vector<npc *> const &npcs)
 
 			if (n->dead) {
 				(void)mvwprintw(nwin, static_cast<int>(i + 1U),
-					2, "%u.\t'%c'\t(dead)\t\t%s", i + cpos,
-					n->symb, n->name.c_str());
+					2, "%u.\t'%c'\t(dead)\t\t%.*s",
+					i + cpos, n->proto->symb,
+					(int)n->proto->name.size(),
+					n->proto->name.data());
 				continue;
 			}
 
@@ -1042,10 +1060,12 @@ npc_list(WINDOW *const nwin, std::vector<npc *> const &npcs)
 			int dy = player.y - n->y;
 
 			(void)mvwprintw(nwin, static_cast<int>(i + 1U), 2,
-				"%u.\t'%c'\t%d %s and %d %s\t%s", i + cpos,
-				n->symb, abs(dy), dy > 0 ? "north" : "south",
+				"%u.\t'%c'\t%d %s and %d %s\t%.*s", i + cpos,
+				n->proto->symb, abs(dy),
+				dy > 0 ? "north" : "south",
 				abs(dx), dx > 0 ? "west" : "east",
-				n->name.c_str());
+				(int)n->proto->name.size(),
+				n->proto->name.data());
 		}
 
 		for (; i < HEIGHT - 2; ++i) {
@@ -1056,7 +1076,7 @@ npc_list(WINDOW *const nwin, std::vector<npc *> const &npcs)
 			errx(1, "npc_list wrefresh");
 		}
 
-		switch(wgetch(nwin)) {
+		switch(journal_key(nwin)) {
 		case ERR:
 			errx(1, "npc_list wgetch ERR");
 			return;
@@ -1082,15 +1102,23 @@ npc_list(WINDOW *const nwin, std::vector<npc *> const &npcs)
 static void
 defog(WINDOW *const win)
 {
-	for (uint8_t x = 1; x < WIDTH - 1; ++x) {
-		for (uint8_t y = 1; y < HEIGHT - 1; ++y) {
-			npc_obj_or_tile(win, y, x);
+	WINDOW *fog;
+
+	if ((fog = dupwin(pad)) == NULL) {
+		errx(1, "defog dupwin");
+	}
+
+	for (int x = 1; x < tiles.width - 1; ++x) {
+		for (int y = 1; y < tiles.height - 1; ++y) {
+			npc_obj_or_tile(fog, (uint16_t)y, (uint16_t)x);
 		}
 	}
 
-	wattron(win, player.color);
-	(void)mvwaddch(win, player.y, player.x, player.symb);
-	wattroff(win, player.color);
+	wattron(fog, player.proto->color);
+	(void)mvwaddch(fog, player.y, player.x, player.proto->symb);
+	wattroff(fog, player.proto->color);
+
+	view(win, fog, player.y, player.x);
 
 	(void)mvwprintw(win, HEIGHT - 1, 2, "[ press any key to exit ]");
 
@@ -1098,12 +1126,16 @@ defog(WINDOW *const win)
 		errx(1, "defog wrefresh");
 	}
 
-	(void)wgetch(win);
+	(void)journal_key(win);
+
+	if (delwin(fog) == ERR) {
+		errx(1, "defog delwin");
+	}
 }
 #endif
 
 static void
-crosshair(WINDOW *const win, uint8_t const y, uint8_t const x)
+crosshair(WINDOW *const win, int const y, int const x)
 {
 	for (int i = 1; i < HEIGHT - 1; ++i) {
 		if (i != y) {
@@ -1141,11 +1173,14 @@ inspect(WINDOW *const win)
 #endif
 {
 	WINDOW *twin;
-	uint8_t y = player.y;
-	uint8_t x = player.x;
+	uint16_t y = player.y;
+	uint16_t x = player.x;
 	bool ret = true;
 
 	while (1) {
+		/* keep the cursor on screen */
+		view(win, pad, y, x);
+
 		if ((twin = dupwin(win)) == NULL) {
 			errx(1, "inspect dupwin");
 		}
@@ -1154,7 +1189,7 @@ inspect(WINDOW *const win)
 			errx(1, "inspect touchwin");
 		}
 
-		crosshair(twin, y, x);
+		crosshair(twin, y - view_y + 1, x - view_x + 1);
 
 #ifdef DEBUG
 		if (teleport) {
@@ -1175,7 +1210,7 @@ inspect(WINDOW *const win)
 			errx(1, "inspect wrefresh");
 		}
 
-		switch(wgetch(win)) {
+		switch(journal_key(win)) {
 		case ERR:
 			errx(1, "inspect wgetch ERR");
 			break;
@@ -1239,8 +1274,10 @@ inspect(WINDOW *const win)
 		case 'r':
 			if (teleport) {
 				/* random teleport location */
-				x = rr.rrand<uint8_t>(2, WIDTH - 1);
-				y = rr.rrand<uint8_t>(2, HEIGHT - 1);
+				x = rr.rrand<uint16_t>(2,
+					(uint16_t)(tiles.width - 1));
+				y = rr.rrand<uint16_t>(2,
+					(uint16_t)(tiles.height - 1));
 			}
 
 			break;
@@ -1248,18 +1285,19 @@ inspect(WINDOW *const win)
 		case 't':
 		case 'g':
 #ifdef DEBUG
-			if (teleport && tiles[y][x].n == NULL) {
+			if (teleport && tiles.n(y, x) == NULL) {
 				/* complete teleport */
-				tiles[y][x].v = true;
+				tiles.v(y, x) = true;
 				move_logic(win, player, y, x);
+				dijkstra_invalidate();
 				goto exit;
 			}
 
-			if (!teleport && tiles[y][x].n != NULL) {
+			if (!teleport && tiles.n(y, x) != NULL) {
 #else
-			if (tiles[y][x].n != NULL) {
+			if (tiles.n(y, x) != NULL) {
 #endif
-				thing_details(twin, *tiles[y][x].n);
+				thing_details(twin, *tiles.n(y, x)->proto);
 			}
 
 			break;
@@ -1270,14 +1308,14 @@ inspect(WINDOW *const win)
 			break;
 		}
 
-		if (x >= WIDTH - 1) {
-			x = WIDTH - 2;
+		if (x >= tiles.width - 1) {
+			x = (uint16_t)(tiles.width - 2);
 		} else if (x < 1) {
 			x = 1;
 		}
 
-		if (y >= HEIGHT - 1) {
-			y = HEIGHT - 2;
+		if (y >= tiles.height - 1) {
+			y = (uint16_t)(tiles.height - 2);
 		} else if (y < 1) {
 			y = 1;
 		}
@@ -1292,10 +1330,26 @@ inspect(WINDOW *const win)
 	return ret;
 }
 
+/* show the part of map around (y, x) inside the box of win */
+static void
+view(WINDOW *const win, WINDOW *const map, int const y, int const x)
+{
+	int const rows = HEIGHT - 2;
+	int const cols = WIDTH - 2;
+
+	view_y = std::clamp(y - rows / 2, 1, tiles.height - 1 - rows);
+	view_x = std::clamp(x - cols / 2, 1, tiles.width - 1 - cols);
+
+	if (copywin(map, win, view_y, view_x, 1, 1, rows, cols, false)
+		== ERR) {
+		errx(1, "view copywin");
+	}
+}
+
 static bool
 viewable(int const y, int const x)
 {
-	return !tiles[y][x].v && pc_visible(x, y)
+	return !tiles.v(y, x) && pc_visible(x, y)
 		&& (pc_visible(x - 1, y + 0)
 		|| pc_visible(x + 1, y + 0)
 		|| pc_visible(x + 0, y - 1)
@@ -1309,35 +1363,36 @@ viewable(int const y, int const x)
 static void
 pc_viewbox(WINDOW *const win, int const lum)
 {
-	uint8_t const start_x = (uint8_t)subu32(player.x + 1, lum);
-	uint8_t const end_x = (uint8_t)(player.x + lum);
+	uint16_t const start_x = (uint16_t)subu32(player.x + 1, lum);
+	uint16_t const end_x = (uint16_t)(player.x + lum);
 
-	uint8_t const start_y = (uint8_t)subu32(player.y + 1, lum);
-	uint8_t const end_y = (uint8_t)(player.y + lum);
+	uint16_t const start_y = (uint16_t)subu32(player.y + 1, lum);
+	uint16_t const end_y = (uint16_t)(player.y + lum);
 
-	for (uint8_t i = start_x; i <= end_x && i < WIDTH - 1; ++i) {
-		for (uint8_t j = start_y; j <= end_y && j < HEIGHT - 1; ++j) {
+	for (uint16_t i = start_x; i <= end_x && i < tiles.width - 1; ++i) {
+		for (uint16_t j = start_y; j <= end_y && j < tiles.height - 1;
+			++j) {
 			if (!viewable(j, i)) {
 				continue;
 			}
 
-			tiles[j][i].v = true;
+			tiles.v(j, i) = true;
 			npc_obj_or_tile(win, j, i);
 		}
 	}
 }
 
 static void
-try_carry(uint8_t const y, uint8_t const x)
+try_carry(uint16_t const y, uint16_t const x)
 {
-	if (tiles[y][x].o == NULL) {
+	if (tiles.o(y, x) == NULL) {
 		return;
 	}
 
 	for (int i = 0; i < PC_CARRY_MAX; ++i) {
 		if (!pc_carry[i].has_value()) {
-			pc_carry[i] = *tiles[y][x].o;
-			tiles[y][x].o = NULL;
+			pc_carry[i] = *tiles.o(y, x);
+			tiles.o(y, x) = NULL;
 			return;
 		}
 	}
@@ -1394,19 +1449,20 @@ carry_list(WINDOW *const cwin, carry_action const action)
 
 		for (int i = 0; i < PC_CARRY_MAX; ++i) {
 			if (pc_carry[i].has_value()) {
-				wattron(cwin, pc_carry[i]->color);
+				obj_proto const &p = *pc_carry[i]->proto;
+
+				wattron(cwin, p.color);
 				(void)mvwprintw(cwin, i + 5, 2,
-					"%d. %s: \t'%c'\t%s", i,
-					type_map_name[pc_carry[i]->obj_type],
-					pc_carry[i]->symb,
-					pc_carry[i]->name.c_str());
-				wattroff(cwin, pc_carry[i]->color);
+					"%d. %s: \t'%c'\t%.*s", i,
+					type_map_name[p.obj_type], p.symb,
+					(int)p.name.size(), p.name.data());
+				wattroff(cwin, p.color);
 			} else {
 				(void)mvwprintw(cwin, i + 5, 2, "%u.", i);
 			}
 		}
 
-		int const ch = wgetch(cwin);
+		int const ch = journal_key(cwin);
 
 		if (action == CARRY_LIST) {
 			return;
@@ -1437,7 +1493,8 @@ carry_list(WINDOW *const cwin, carry_action const action)
 			}
 
 			if (action == CARRY_WEAR) {
-				if (!type_map_equip[pc_carry[i]->obj_type]) {
+				if (!type_map_equip[
+					pc_carry[i]->proto->obj_type]) {
 					error = std::string("item in slot ")
 						+ std::to_string(i)
 						+ " cannot be eqipped";
@@ -1446,12 +1503,18 @@ carry_list(WINDOW *const cwin, carry_action const action)
 
 				carry_to_equip(i);
 			} else if (action == CARRY_DROP) {
-				tiles[player.y][player.x].o = &(*pc_carry[i]);
+				obj *const o = new obj(*pc_carry[i]);
+
+				o->x = player.x;
+				o->y = player.y;
+
+				cur_level.objs.push_back(o);
+				tiles.o(player.y, player.x) = o;
 				pc_carry[i].reset();
 			} else if (action == CARRY_REMOVE) {
 				pc_carry[i].reset();
 			} else if (action == CARRY_INSPECT) {
-				thing_details(cwin, *pc_carry[i]);
+				thing_details(cwin, *pc_carry[i]->proto);
 			}
 
 			break;
@@ -1464,10 +1527,11 @@ print_equipped(WINDOW *const ewin, int const i, char const *const name,
 	char const ch, std::optional<obj> const &item)
 {
 	if (item.has_value()) {
-		wattron(ewin, item->color);
-		(void)mvwprintw(ewin, i, 2, "%s\t%c.\t'%c'\t%s", name, ch,
-			item->symb, item->name.c_str());
-		wattroff(ewin, item->color);
+		wattron(ewin, item->proto->color);
+		(void)mvwprintw(ewin, i, 2, "%s\t%c.\t'%c'\t%.*s", name, ch,
+			item->proto->symb, (int)item->proto->name.size(),
+			item->proto->name.data());
+		wattroff(ewin, item->proto->color);
 	} else {
 		(void)mvwprintw(ewin, i, 2, "%s\t%c.", name, ch);
 	}
@@ -1519,7 +1583,7 @@ equip_list(WINDOW *const ewin, bool const take)
 				std::get<2>(equip[i]), *std::get<0>(equip[i]));
 		}
 
-		int const ch = wgetch(ewin);
+		int const ch = journal_key(ewin);
 
 		if (!take) {
 			return;
@@ -1543,7 +1607,7 @@ carry_to_equip(int const i)
 {
 	std::optional<obj> *equip_slot;
 
-	switch(pc_carry[i]->obj_type) {
+	switch(pc_carry[i]->proto->obj_type) {
 	case amulet:
 		equip_slot = &pc_equip.amulet;
 		break;
@@ -1636,6 +1700,7 @@ equip_to_carry(int const i, std::optional<std::string> &error)
 
 	if (!equip_slot->has_value()) {
 		error = std::string("slot ") + (char)i + " has no item";
+		return;
 	}
 
 	for (int j = 0; j < PC_CARRY_MAX; ++j) {
@@ -1651,8 +1716,8 @@ equip_to_carry(int const i, std::optional<std::string> &error)
 static void
 swap(std::optional<obj> &carry, std::optional<obj> &equip) {
 	if (!carry.has_value()) {
-		player.hp = subu64(player.hp, equip->def);
-		player.speed = subu64(player.speed, equip->speed);
+		player.hp = subu64(player.hp, equip->proto->def);
+		player.speed = subu64(player.speed, equip->proto->speed);
 
 		if (player.hp == 0) {
 			player.hp = 1;
@@ -1662,25 +1727,29 @@ swap(std::optional<obj> &carry, std::optional<obj> &equip) {
 			player.speed = 1;
 		}
 	} else {
-		player.hp = subu64(player.hp, equip->def);
-		player.hp += carry->def;
+		/* an empty slot has no description to read */
+		if (equip.has_value()) {
+			player.hp = subu64(player.hp, equip->proto->def);
+			player.speed = subu64(player.speed,
+				equip->proto->speed);
+		}
 
-		player.speed = subu64(player.speed, equip->speed);
-		player.speed += carry->speed;
+		player.hp += carry->proto->def;
+		player.speed += carry->proto->speed;
 	}
 	std::swap(carry, equip);
 }
 static void
 thing_details(WINDOW *const win, dungeon_thing const &d)
 {
-	std::stringstream ss(d.desc);
+	std::stringstream ss{std::string(d.desc)};
 	std::string tmp;
 
 	std::vector<std::string> lines;
 	std::vector<std::string>::size_type cpos = 0;
 
 	lines.push_back(std::string("Symbol: '") + (char)d.symb + "'\tName: "
-		+ d.name);
+		+ std::string(d.name));
 	lines.push_back("");
 
 	while (std::getline(ss, tmp, '\n')) {
@@ -1711,7 +1780,7 @@ thing_details(WINDOW *const win, dungeon_thing const &d)
 			errx(1, "thing_details wrefresh");
 		}
 
-		switch(wgetch(win)) {
+		switch(journal_key(win)) {
 		case ERR:
 			errx(1, "thing_details wgetch ERR");
 			return;
@@ -1732,3 +1801,65 @@ thing_details(WINDOW *const win, dungeon_thing const &d)
 		}
 	}
 }
+
+/* what the PC saw of a floor it left, or of a restored one */
+static void
+redraw_visited(WINDOW *const win)
+{
+	for (uint16_t i = 1; i < tiles.height - 1; ++i) {
+		for (uint16_t j = 1; j < tiles.width - 1; ++j) {
+			if (tiles.v(i, j)) {
+				npc_obj_or_tile(win, i, j);
+			}
+		}
+	}
+}
+
+static std::array<std::optional<obj> *, 12>
+equip_slots()
+{
+	return {{
+		&pc_equip.amulet,
+		&pc_equip.armor,
+		&pc_equip.boots,
+		&pc_equip.cloak,
+		&pc_equip.gloves,
+		&pc_equip.helmet,
+		&pc_equip.light,
+		&pc_equip.offhand,
+		&pc_equip.ranged,
+		&pc_equip.ring_left,
+		&pc_equip.ring_right,
+		&pc_equip.weapon
+	}};
+}
+
+/* items only point at their descriptions, so the index is enough */
+static void
+save_item(std::vector<uint8_t> &buf, std::optional<obj> const &o)
+{
+	pack_put<uint8_t>(buf, o.has_value());
+
+	if (o.has_value()) {
+		pack_put<uint32_t>(buf, (uint32_t)proto_index(*o));
+	}
+}
+
+static void
+load_item(std::vector<uint8_t> const &buf, std::size_t &pos,
+	std::optional<obj> &o)
+{
+	o.reset();
+
+	if (pack_get<uint8_t>(buf, pos) == 0) {
+		return;
+	}
+
+	std::size_t const proto = pack_get<uint32_t>(buf, pos);
+
+	if (proto >= objs_parsed.size()) {
+		errx(1, "snapshot item %zu invalid", proto);
+	}
+
+	o = obj(objs_parsed[proto]);
+}
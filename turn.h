@@ -18,16 +18,26 @@
 #ifndef TURN_H
 #define TURN_H
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 #include <ncurses.h>
 
 enum turn_exit {
 	TURN_DEATH,
-	TURN_NEXT,
+	TURN_DN,
 	TURN_NONE,
 	TURN_QUIT,
+	TURN_UP,
 	TURN_WIN,
 };
 
-enum turn_exit	turn_engine(WINDOW *const, unsigned int const, unsigned int const);
+enum turn_exit	turn_engine(WINDOW *const);
+void		turn_seed();
+
+/* snapshots, taken after a quit */
+void	turn_save(std::vector<uint8_t> &);
+void	turn_load(std::vector<uint8_t> const &, std::size_t &);
 
 #endif /* TURN_H */
@@ -0,0 +1,133 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <err.h>
+
+#include <cinttypes>
+
+#include "globs.h"
+#include "wheel.h"
+
+static std::size_t constexpr MASK = turn_wheel::SLOTS - 1;
+static std::size_t constexpr WORDS = turn_wheel::SLOTS / 64;
+
+/* empty, with nothing due before turn now */
+void
+turn_wheel::reset(uint64_t const t)
+{
+	head.fill(NULL);
+	tail.fill(NULL);
+	busy.fill(0);
+	now = t;
+	size = 0;
+}
+
+/* n acts at n.turn, after those already due then */
+void
+turn_wheel::schedule(npc &n)
+{
+	if (n.turn < now || n.turn - now >= SLOTS) {
+		errx(1, "turn wheel cannot hold turn %" PRIu64 " at %" PRIu64,
+			n.turn, now);
+	}
+
+	std::size_t const s = n.turn & MASK;
+
+	n.next = NULL;
+	n.prev = tail[s];
+
+	if (tail[s] == NULL) {
+		head[s] = &n;
+		busy[s / 64] |= UINT64_C(1) << (s % 64);
+	} else {
+		tail[s]->next = &n;
+	}
+
+	tail[s] = &n;
+	size++;
+}
+
+/* drop n if it is waiting */
+void
+turn_wheel::cancel(npc &n)
+{
+	std::size_t const s = n.turn & MASK;
+
+	if (n.prev == NULL && head[s] != &n) {
+		return;
+	}
+
+	if (n.prev == NULL) {
+		head[s] = n.next;
+	} else {
+		n.prev->next = n.next;
+	}
+
+	if (n.next == NULL) {
+		tail[s] = n.prev;
+	} else {
+		n.next->prev = n.prev;
+	}
+
+	if (head[s] == NULL) {
+		busy[s / 64] &= ~(UINT64_C(1) << (s % 64));
+	}
+
+	n.next = NULL;
+	n.prev = NULL;
+	size--;
+}
+
+/* take the first npc due, which the wheel must hold */
+npc &
+turn_wheel::next()
+{
+	std::size_t const from = now & MASK;
+	uint64_t word;
+	std::size_t w;
+
+	if (size == 0) {
+		errx(1, "turn wheel empty");
+	}
+
+	/* the bits below from in its word are only due after a lap */
+	word = busy[from / 64] & (~UINT64_C(0) << (from % 64));
+
+	for (w = from / 64; word == 0; word = busy[w]) {
+		w = (w + 1) % WORDS;
+	}
+
+	npc &n = *head[w * 64 + (std::size_t)__builtin_ctzll(word)];
+
+	cancel(n);
+	now = n.turn;
+
+	return n;
+}
+
+/* the waiting npcs in the order they are due */
+void
+turn_wheel::pending(std::vector<npc *> &out) const
+{
+	out.clear();
+
+	for (std::size_t i = 0; i < SLOTS; ++i) {
+		for (npc *n = head[(now + i) & MASK]; n != NULL; n = n->next) {
+			out.push_back(n);
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * OPAL's playable almost indefectibly.
+ * Copyright (C) 2019  Esote
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct npc;
+
+/*
+ * The turn queue as a timing wheel. An actor acting at turn t is next due
+ * by t + 1 + 1000/speed, never more than 1001 turns out, so one ring of
+ * slots indexed by turn covers every pending actor. Each slot is a list
+ * threaded through the actors themselves, drained first in first out,
+ * and a bitmap of the busy slots finds the next one.
+ */
+struct turn_wheel {
+	static std::size_t constexpr SLOTS = 1024;
+
+	std::array<npc *, SLOTS>		head;
+	std::array<npc *, SLOTS>		tail;
+	std::array<uint64_t, SLOTS / 64>	busy;
+	uint64_t				now;
+	std::size_t				size;
+
+	void	reset(uint64_t const);
+	void	schedule(npc &);
+	void	cancel(npc &);
+	npc	&next();
+	void	pending(std::vector<npc *> &) const;
+};
+
+#endif /* WHEEL_H */